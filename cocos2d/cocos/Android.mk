@@ -162,8 +162,11 @@ base/etc1.cpp \
 base/pvr.cpp \
 base/s3tc.cpp \
 renderer/CCArbitraryVertexCommand.cpp \
+renderer/CCBatchBreakStats.cpp \
 renderer/CCBatchCommand.cpp \
+renderer/CCBufferDirtyTracker.cpp \
 renderer/CCCustomCommand.cpp \
+renderer/CCFrameCapture.cpp \
 renderer/CCGLProgram.cpp \
 renderer/CCGLProgramCache.cpp \
 renderer/CCGLProgramState.cpp \
@@ -171,13 +174,21 @@ renderer/CCGLProgramStateCache.cpp \
 renderer/CCGroupCommand.cpp \
 renderer/CCMaterial.cpp \
 renderer/CCMeshCommand.cpp \
+renderer/CCOcclusionCuller.cpp \
 renderer/CCPass.cpp \
 renderer/CCPrimitive.cpp \
 renderer/CCPrimitiveCommand.cpp \
 renderer/CCQuadCommand.cpp \
 renderer/CCRenderCommand.cpp \
+renderer/CCRenderDevice.cpp \
 renderer/CCRenderState.cpp \
 renderer/CCRenderer.cpp \
+renderer/CCRendererBenchmark.cpp \
+renderer/CCRendererBufferTuner.cpp \
+renderer/CCRendererMemoryBudget.cpp \
+renderer/CCRendererMemoryStats.cpp \
+renderer/CCRendererProfiler.cpp \
+renderer/CCSpriteBatchCommand.cpp \
 renderer/CCTechnique.cpp \
 renderer/CCTexture2D.cpp \
 renderer/CCTextureAtlas.cpp \
@@ -185,6 +196,8 @@ renderer/CCTextureCache.cpp \
 renderer/CCTextureCube.cpp \
 renderer/CCTrianglesCommand.cpp \
 renderer/CCVertexAttribBinding.cpp \
+renderer/CCVertexCacheOptimizer.cpp \
+renderer/CCVertexFormatRegistry.cpp \
 renderer/CCVertexIndexBuffer.cpp \
 renderer/CCVertexIndexData.cpp \
 renderer/ccGLStateCache.cpp \
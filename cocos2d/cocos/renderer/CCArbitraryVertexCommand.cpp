@@ -2,7 +2,7 @@
 
 NS_CC_BEGIN
 
-ArbitraryVertexCommand::ArbitraryVertexCommand() : _material2d(nullptr)
+ArbitraryVertexCommand::ArbitraryVertexCommand() : _compactVertexFormat(false), _hasDepth2D(false), _orderDepth2D(0), _hasOcclusionBounds(false), _hasOpaqueRect(false), _material2d(nullptr)
 {
 	_type = RenderCommand::Type::ARBITRARY_VERTEX_COMMAND;
 }
@@ -38,8 +38,35 @@ void ArbitraryVertexCommand::init(float globalOrder,
 
 	_data = data;
 	_transformOnCpu = transformOnCpu;
+	_hasDepth2D = false;
+	_orderDepth2D = 0;
+	_hasOcclusionBounds = false;
+	_hasOpaqueRect = false;
+	_emit = nullptr;
 
 	_material2d = material2d;
 }
 
+void ArbitraryVertexCommand::initEmitter(float globalOrder,
+	Material2D * material2d,
+	ssize_t vertexCount,
+	ssize_t indexCount,
+	const EmitCallback& emit,
+	const Mat4 & mv,
+	bool transformOnCpu,
+	uint32_t flags)
+{
+	CCASSERT(emit, "Invalid emit callback");
+	CCASSERT(material2d && material2d->getPrimitiveType() == material2d->getBatchPrimitiveType(), "Emitting commands have to use a list primitive type");
+	CCASSERT(transformOnCpu || material2d->getMatrixPaletteSize() == 0, "Emitting commands cant use a matrix palette");
+
+	Data data;
+	data.vertexData = nullptr;
+	data.vertexCount = vertexCount;
+	data.indexData = nullptr;
+	data.indexCount = indexCount;
+	init(globalOrder, material2d, data, mv, transformOnCpu, flags);
+	_emit = emit;
+}
+
 NS_CC_END
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <functional>
+
 #include "renderer\CCRenderCommand.h"
 #include "renderer\Material2D.h"
 
@@ -22,6 +24,11 @@ public:
 		ssize_t indexCount;
 	};
 
+	/* Writes the vertices and indices of an emitting command straight into the renderers vertex and index buffer.
+	vertices has room for vertexCount vertices in the material format, indices for indexCount indices and is null for non indexed commands.
+	indexBase has to be added to every index */
+	typedef std::function<void(byte* vertices, unsigned short* indices, unsigned short indexBase)> EmitCallback;
+
 	ArbitraryVertexCommand();
 	/**Destructor.*/
 	~ArbitraryVertexCommand();
@@ -42,13 +49,31 @@ public:
 		bool transformOnCpu = true,
 		uint32_t flags = 0);
 
+	/** Initializes the command as an emitting command: instead of pointing at vertex data, emit is called while the renderer gathers the
+	command and writes the vertices into the renderers buffer, which saves building them in an own array just to be copied.
+	The renderer still batches the command like any other. Only list primitive types are supported, the compact vertex format is ignored
+	and gpu transformed commands cant use a matrix palette.
+	@param vertexCount The number of vertices emit writes.
+	@param indexCount The number of indices emit writes, 0 for non indexed data.
+	*/
+	void initEmitter(float globalOrder,
+		Material2D* material2d,
+		ssize_t vertexCount,
+		ssize_t indexCount,
+		const EmitCallback& emit,
+		const Mat4& mv,
+		bool transformOnCpu = true,
+		uint32_t flags = 0);
+
+	inline bool isEmitter() const { return _emit != nullptr; }
+
 	inline Material2D* getMaterial() const { return _material2d; }
 	/**Get the model view matrix.*/
 	inline const Mat4& getModelView() const { return _mv; }
 
 	// dynamic buffer command
 
-	// Gets the dynamic command's data.
+	// Gets the dynamic command's data. The pointers are null for emitting commands
 	inline const Data& getData() const { return _data; }
 	// Gets the dynamic command's vertex count.
 	inline ssize_t getVertexCount() const { return _data.vertexCount; }
@@ -64,12 +89,44 @@ public:
 	/*Get the dynamic command's transform on cpu flag. Do not use this function if the command is a buffer command*/
 	inline bool isTransformedOnCpu() const { return _transformOnCpu; }
 
+	/* Opt in to the compact vertex format. The renderer then converts the vertices to V2F_C4B_T2US while gathering, which needs 16 instead of 24 bytes per vertex.
+	Only used for V3F_C4B_T2F data that is transformed on the cpu and only while depth test for 2d is disabled.
+	The caller guarantees that the transformed z is 0 and that the texture coordinates are within 0..1, as z is dropped and the coords are stored as unsigned shorts */
+	inline void setCompactVertexFormat(bool compact) { _compactVertexFormat = compact; }
+	inline bool isCompactVertexFormat() const { return _compactVertexFormat; }
+
+	/* The z the vertices get in the opaque 2d pass of the renderer (see Renderer::setOpaque2DEnabled). Reset by init.
+	Defaults to the place of the command in the draw order, mapped into the renderer's opaque 2d depth range; an explicit depth should lie within that range too */
+	inline void setDepth2D(float depth) { _depth = depth; _hasDepth2D = true; }
+	inline float getDepth2D() const { return _hasDepth2D ? _depth : _orderDepth2D; }
+	// whether the command is drawn without blending and can be drawn in any order with depth test
+	inline bool isOpaque2D() const {
+		return !_is3D && _material2d->getBlendFunc().src == GL_ONE && _material2d->getBlendFunc().dst == GL_ZERO;
+	}
+
+	/* Occlusion culling (see Renderer::setOcclusionCullingEnabled), both rects are in the local space of the vertices and reset by init.
+	The bounds have to contain everything the command draws, the command is skipped when opaque commands in front cover them.
+	The opaque rect is the part that is drawn completely opaque, it is only used when the material doesnt blend */
+	inline void setOcclusionBounds(const Rect& bounds) { _occlusionBounds = bounds; _hasOcclusionBounds = true; }
+	inline void setOpaqueRect(const Rect& rect) { _opaqueRect = rect; _hasOpaqueRect = true; }
+
 protected:
 
 	friend Renderer;
+	friend FrameCapture;
+	friend FrameReplay;
 
 	bool _transformOnCpu;
+	bool _compactVertexFormat;
+	bool _hasDepth2D;
+	// assigned by the renderer every frame from the submission order
+	float _orderDepth2D;
+	bool _hasOcclusionBounds;
+	bool _hasOpaqueRect;
+	Rect _occlusionBounds;
+	Rect _opaqueRect;
 	Data _data;
+	EmitCallback _emit;
 
 	Material2D* _material2d;
 	bool _isIndexed;
@@ -0,0 +1,77 @@
+#include "renderer/CCBatchBreakStats.h"
+
+#include <algorithm>
+#include <string.h>
+
+NS_CC_BEGIN
+
+static const char* s_reasonNames[BATCH_BREAK_REASON_COUNT] = {
+	"material",
+	"skip_batching",
+	"index_limit",
+	"vbo_slice",
+	"matrix",
+	"vertex_format"
+};
+
+BatchBreakStats::BatchBreakStats()
+	: _trackMaterialPairs(false)
+{
+	clear();
+}
+
+void BatchBreakStats::clear()
+{
+	_breakCount = 0;
+	memset(_reasonCounts, 0, sizeof(_reasonCounts));
+	_materialPairs.clear();
+}
+
+std::vector<BatchBreakStats::MaterialPair> BatchBreakStats::getTopMaterialPairs(int n) const
+{
+	std::vector<MaterialPair> pairs;
+	pairs.reserve(_materialPairs.size());
+	for (auto& entry : _materialPairs) {
+		MaterialPair pair;
+		pair.from = (uint32_t)(entry.first >> 32);
+		pair.to = (uint32_t)entry.first;
+		pair.count = entry.second;
+		pairs.push_back(pair);
+	}
+
+	n = std::min(n, (int)pairs.size());
+	std::partial_sort(pairs.begin(), pairs.begin() + n, pairs.end(), [](const MaterialPair& a, const MaterialPair& b) {
+		return a.count > b.count;
+	});
+	pairs.resize(n);
+	return pairs;
+}
+
+std::string BatchBreakStats::dump(int topMaterialPairs) const
+{
+	std::string result;
+	char buffer[128];
+
+	snprintf(buffer, sizeof(buffer), "batch breaks: %d\n", _breakCount);
+	result += buffer;
+	for (int i = 0; i < BATCH_BREAK_REASON_COUNT; i++) {
+		snprintf(buffer, sizeof(buffer), "  %s: %d\n", s_reasonNames[i], _reasonCounts[i]);
+		result += buffer;
+	}
+
+	if (_trackMaterialPairs) {
+		result += "top material pairs:\n";
+		for (auto& pair : getTopMaterialPairs(topMaterialPairs)) {
+			snprintf(buffer, sizeof(buffer), "  %08x -> %08x: %d\n", pair.from, pair.to, pair.count);
+			result += buffer;
+		}
+	}
+	return result;
+}
+
+const char* BatchBreakStats::getReasonName(BatchBreakReason reason)
+{
+	return s_reasonNames[reason];
+}
+
+NS_CC_END
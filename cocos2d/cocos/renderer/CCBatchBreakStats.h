@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "platform/CCPlatformMacros.h"
+
+NS_CC_BEGIN
+
+// why the renderer could not append an ArbitraryVertexCommand to the current draw
+enum BatchBreakReason {
+	BATCH_BREAK_MATERIAL, // the material differs from the previous one
+	BATCH_BREAK_SKIP_BATCHING, // the current or previous material does not batch
+	BATCH_BREAK_INDEX_LIMIT, // the vertices would exceed what a short index can address
+	BATCH_BREAK_VBO_SLICE, // the current vbo slice is full
+	BATCH_BREAK_MATRIX, // a gpu transformed command with a different model view, or a change between cpu and gpu transform
+	BATCH_BREAK_VERTEX_FORMAT, // the vertex format differs from the previous one
+	BATCH_BREAK_REASON_COUNT
+};
+
+/* Counts the batch breaks of one frame by reason.
+A break can have several reasons at once, each of them is counted, so the reason counts may add up to more than getBreakCount.
+The material id pairs (previous -> current) of the breaks are only tracked when enabled with setTrackMaterialPairs */
+class CC_DLL BatchBreakStats {
+public:
+	struct MaterialPair {
+		uint32_t from;
+		uint32_t to;
+		int count;
+	};
+
+	BatchBreakStats();
+
+	void clear();
+
+	// reasons is a bit mask of (1 << BatchBreakReason)
+	inline void addBreak(unsigned int reasons, uint32_t fromMaterial, uint32_t toMaterial) {
+		_breakCount++;
+		for (int i = 0; i < BATCH_BREAK_REASON_COUNT; i++) {
+			if (reasons & (1 << i)) {
+				_reasonCounts[i]++;
+			}
+		}
+		if (_trackMaterialPairs) {
+			_materialPairs[((uint64_t)fromMaterial << 32) | toMaterial]++;
+		}
+	}
+
+	int getBreakCount() const { return _breakCount; }
+	int getCount(BatchBreakReason reason) const { return _reasonCounts[reason]; }
+
+	void setTrackMaterialPairs(bool track) { _trackMaterialPairs = track; }
+	bool isTrackingMaterialPairs() const { return _trackMaterialPairs; }
+	// the n material pairs that caused the most breaks, most frequent first
+	std::vector<MaterialPair> getTopMaterialPairs(int n) const;
+
+	// a human readable summary of the reasons and the top n material pairs
+	std::string dump(int topMaterialPairs = 10) const;
+
+	static const char* getReasonName(BatchBreakReason reason);
+
+protected:
+	int _breakCount;
+	int _reasonCounts[BATCH_BREAK_REASON_COUNT];
+	bool _trackMaterialPairs;
+	std::unordered_map<uint64_t, int> _materialPairs;
+};
+
+NS_CC_END
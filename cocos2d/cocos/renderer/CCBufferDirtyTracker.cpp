@@ -0,0 +1,89 @@
+#include "renderer/CCBufferDirtyTracker.h"
+
+#include <algorithm>
+#include <string.h>
+
+NS_CC_BEGIN
+
+const ssize_t BufferDirtyTracker::BLOCK_SIZE;
+const int BufferDirtyTracker::MERGE_GAP_BLOCKS;
+
+BufferDirtyTracker::BufferDirtyTracker()
+	: _capacity(0)
+	, _valid(false)
+{
+}
+
+uint64_t BufferDirtyTracker::hashBlock(const uint8_t* data, ssize_t size)
+{
+	// fnv-1a on 8 byte words
+	uint64_t hash = 14695981039346656037ULL;
+	const uint8_t* end = data + size;
+	for (; data + 8 <= end; data += 8) {
+		uint64_t word;
+		memcpy(&word, data, 8);
+		hash = (hash ^ word) * 1099511628211ULL;
+	}
+	for (; data < end; data++) {
+		hash = (hash ^ *data) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+bool BufferDirtyTracker::update(const void* data, ssize_t size, float maxDirtyRatio, std::vector<BufferRange>& ranges)
+{
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+	size_t blockCount = (size_t)((size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+
+	_newHashes.resize(blockCount);
+	for (size_t i = 0; i < blockCount; i++) {
+		ssize_t offset = i * BLOCK_SIZE;
+		_newHashes[i] = hashBlock(bytes + offset, std::min(BLOCK_SIZE, size - offset));
+	}
+
+	bool respecify = !_valid || size > _capacity;
+
+	size_t firstRange = ranges.size();
+	ssize_t dirtyBytes = 0;
+	if (!respecify) {
+		// blocks past the old data count as dirty
+		ssize_t runStart = -1;
+		ssize_t runEnd = -1;
+		for (size_t i = 0; i < blockCount; i++) {
+			if (i < _hashes.size() && _hashes[i] == _newHashes[i]) {
+				continue;
+			}
+			ssize_t offset = i * BLOCK_SIZE;
+			ssize_t end = std::min(offset + BLOCK_SIZE, size);
+			if (runStart >= 0 && offset - runEnd <= MERGE_GAP_BLOCKS * BLOCK_SIZE) {
+				runEnd = end;
+			}
+			else {
+				if (runStart >= 0) {
+					ranges.push_back({ runStart, runEnd - runStart });
+					dirtyBytes += runEnd - runStart;
+				}
+				runStart = offset;
+				runEnd = end;
+			}
+		}
+		if (runStart >= 0) {
+			ranges.push_back({ runStart, runEnd - runStart });
+			dirtyBytes += runEnd - runStart;
+		}
+
+		if (dirtyBytes > size * maxDirtyRatio) {
+			ranges.resize(firstRange);
+			respecify = true;
+		}
+	}
+
+	_hashes.swap(_newHashes);
+	if (respecify) {
+		_capacity = size;
+		_valid = true;
+	}
+	return !respecify;
+}
+
+NS_CC_END
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "platform/CCPlatformMacros.h"
+
+NS_CC_BEGIN
+
+struct BufferRange {
+	ssize_t offset;
+	ssize_t size;
+};
+
+/* Remembers hashes of fixed size blocks of the data last uploaded into one gl buffer, so the next upload into
+the same buffer can be restricted to the blocks that changed. Hashing is cheaper than the driver copy and
+catches data that was modified in place, which pointer or version checks would miss */
+class CC_DLL BufferDirtyTracker {
+public:
+	static const ssize_t BLOCK_SIZE = 1024;
+	// dirty runs separated by up to this many clean blocks are uploaded with one call
+	static const int MERGE_GAP_BLOCKS = 4;
+
+	BufferDirtyTracker();
+
+	/* Compares data with the last update and appends the coalesced dirty ranges to ranges.
+	Returns false if the gl buffer has to be respecified with the whole data instead: its contents are unknown,
+	it is too small for size or more than maxDirtyRatio of the data changed. ranges is left untouched then */
+	bool update(const void* data, ssize_t size, float maxDirtyRatio, std::vector<BufferRange>& ranges);
+	// the next update respecifies the buffer
+	void invalidate() { _valid = false; }
+
+protected:
+	static uint64_t hashBlock(const uint8_t* data, ssize_t size);
+
+	std::vector<uint64_t> _hashes;
+	std::vector<uint64_t> _newHashes;
+	ssize_t _capacity; // size of the buffer storage, set by the last respecification
+	bool _valid;
+};
+
+NS_CC_END
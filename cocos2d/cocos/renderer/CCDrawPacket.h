@@ -0,0 +1,41 @@
+#pragma once
+
+#include "platform/CCPlatformMacros.h"
+#include "platform/CCGL.h"
+#include "math/Mat4.h"
+
+NS_CC_BEGIN
+
+class RenderCommand;
+
+enum DrawPacketType {
+	DRAW_PACKET_NONE, // a batch draw that moved further back in the stream, skipped
+	DRAW_PACKET_BATCH, // draws a vertex batch
+	DRAW_PACKET_COMMAND, // executes a command that isnt batched
+};
+
+// the state a batch draw has to set before drawing, filled in after the buffers are mapped
+enum DrawPacketStateFlags {
+	DRAW_PACKET_BIND_BUFFERS = 1 << 0,
+	DRAW_PACKET_APPLY_FORMAT = 1 << 1,
+	DRAW_PACKET_INDEXED = 1 << 2,
+	DRAW_PACKET_BASE_VERTEX = 1 << 3,
+};
+
+/* One entry of the flat stream the gather phase emits and the draw phase consumes in order.
+A batch is drawn at the position of its last gathered command, so a batch that continues after a command in between
+moves its packet there and leaves a DRAW_PACKET_NONE behind */
+struct DrawPacket {
+	int type;
+	int state;
+	RenderCommand* command; // DRAW_PACKET_COMMAND only
+
+	// DRAW_PACKET_BATCH only
+	int batch;
+	GLenum mode;
+	GLsizei count; // vertices or indices
+	ssize_t first; // the first vertex, or the byte offset into the index buffer for indexed draws
+	Mat4 modelView; // of the first command of the batch, the material is applied with it
+};
+
+NS_CC_END
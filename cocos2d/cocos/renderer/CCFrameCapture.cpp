@@ -0,0 +1,419 @@
+#include "renderer/CCFrameCapture.h"
+
+#include <string.h>
+#include <unordered_map>
+
+#include "renderer/CCRenderer.h"
+#include "renderer/CCGLProgram.h"
+#include "renderer/CCGLProgramState.h"
+#include "platform/CCFileUtils.h"
+
+NS_CC_BEGIN
+
+const uint32_t FrameCapture::MAGIC;
+const uint32_t FrameCapture::VERSION;
+
+template <typename T>
+static inline void writeValue(std::string& out, const T& value)
+{
+	out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+static inline void writeBytes(std::string& out, const void* data, size_t size)
+{
+	out.append(reinterpret_cast<const char*>(data), size);
+	out.append((4 - size % 4) % 4, '\0');
+}
+
+static inline void writeRect(std::string& out, const Rect& rect)
+{
+	float values[4] = { rect.origin.x, rect.origin.y, rect.size.width, rect.size.height };
+	writeValue(out, values);
+}
+
+void FrameCapture::writeMaterial(std::string& out, Material2D* material)
+{
+	writeValue<uint32_t>(out, material->_id);
+	writeValue<uint32_t>(out, material->_glProgramState->getGLProgram()->getProgram());
+	writeValue<uint32_t>(out, material->_textureCount);
+	writeValue(out, material->_textureNames);
+	writeValue<uint32_t>(out, material->_blendFunc.src);
+	writeValue<uint32_t>(out, material->_blendFunc.dst);
+	writeValue<uint32_t>(out, (uint32_t)material->_primitiveType);
+	writeValue<uint32_t>(out, material->_skipBatching);
+	writeValue<uint32_t>(out, material->_paletteSize);
+
+	const VertexStreamAttributes& format = material->_vertexStreamAttributes;
+	writeValue<uint32_t>(out, format.stride);
+	writeValue<uint32_t>(out, format.count);
+	for (auto i = format.infos; i < format.infos + format.count; i++) {
+		int32_t attribute[5] = { i->_offset, i->_semantic, i->_type, i->_size, i->_normalize };
+		writeValue(out, attribute);
+	}
+}
+
+std::string FrameCapture::serialize(std::vector<RenderQueue>& renderGroups)
+{
+	// the material table is written first, so collect the materials before the commands
+	std::unordered_map<Material2D*, uint32_t> materialIndices;
+	std::vector<Material2D*> materials;
+	uint32_t commandCount = 0;
+	for (auto& queue : renderGroups) {
+		for (int g = 0; g < RenderQueue::QUEUE_COUNT; g++) {
+			for (auto command : queue.getSubQueue((RenderQueue::QUEUE_GROUP)g)) {
+				commandCount++;
+				if (command->getType() != RenderCommand::Type::ARBITRARY_VERTEX_COMMAND) {
+					continue;
+				}
+				Material2D* material = static_cast<ArbitraryVertexCommand*>(command)->_material2d;
+				if (materialIndices.find(material) == materialIndices.end()) {
+					materialIndices[material] = (uint32_t)materials.size();
+					materials.push_back(material);
+				}
+			}
+		}
+	}
+
+	std::vector<byte> emittedVertices;
+	std::vector<unsigned short> emittedIndices;
+
+	std::string out;
+	writeValue(out, MAGIC);
+	writeValue(out, VERSION);
+	writeValue<uint32_t>(out, (uint32_t)renderGroups.size());
+	writeValue<uint32_t>(out, (uint32_t)materials.size());
+	writeValue(out, commandCount);
+
+	for (auto material : materials) {
+		writeMaterial(out, material);
+	}
+
+	for (size_t q = 0; q < renderGroups.size(); q++) {
+		for (int g = 0; g < RenderQueue::QUEUE_COUNT; g++) {
+			for (auto command : renderGroups[q].getSubQueue((RenderQueue::QUEUE_GROUP)g)) {
+				uint32_t flags =
+					(command->is3D() ? COMMAND_3D : 0) |
+					(command->isTransparent() ? COMMAND_TRANSPARENT : 0) |
+					(command->isSkipBatching() ? COMMAND_SKIP_BATCHING : 0);
+				writeValue<uint32_t>(out, (uint32_t)q);
+				writeValue<uint32_t>(out, (uint32_t)g);
+				writeValue<uint32_t>(out, (uint32_t)command->getType());
+				writeValue(out, command->getGlobalOrder());
+				writeValue(out, command->getDepth());
+				writeValue(out, flags);
+
+				if (command->getType() == RenderCommand::Type::GROUP_COMMAND) {
+					writeValue<uint32_t>(out, static_cast<GroupCommand*>(command)->getRenderQueueID());
+				}
+				else if (command->getType() == RenderCommand::Type::ARBITRARY_VERTEX_COMMAND) {
+					ArbitraryVertexCommand* avc = static_cast<ArbitraryVertexCommand*>(command);
+					uint32_t avcFlags =
+						(avc->_transformOnCpu ? AVC_TRANSFORM_ON_CPU : 0) |
+						(avc->_compactVertexFormat ? AVC_COMPACT_VERTEX_FORMAT : 0) |
+						(avc->_hasDepth2D ? AVC_DEPTH_2D : 0) |
+						(avc->_hasOcclusionBounds ? AVC_OCCLUSION_BOUNDS : 0) |
+						(avc->_hasOpaqueRect ? AVC_OPAQUE_RECT : 0);
+					writeValue(out, materialIndices[avc->_material2d]);
+					writeValue(out, avc->_mv.m);
+					writeValue(out, avcFlags);
+					writeValue(out, avc->_depth);
+					writeRect(out, avc->_occlusionBounds);
+					writeRect(out, avc->_opaqueRect);
+
+					const ArbitraryVertexCommand::Data& data = avc->_data;
+					ssize_t vertexSize = data.vertexCount * avc->_material2d->getVertexSize();
+					const void* vertices = data.vertexData;
+					const void* indices = data.indexData;
+					if (avc->_emit) {
+						// emitting commands are captured with the data they emit, the replay draws it as plain data
+						emittedVertices.resize(vertexSize);
+						emittedIndices.resize(data.indexCount);
+						avc->_emit(emittedVertices.data(), data.indexCount > 0 ? emittedIndices.data() : nullptr, 0);
+						vertices = emittedVertices.data();
+						indices = emittedIndices.data();
+					}
+					writeValue<uint32_t>(out, (uint32_t)data.vertexCount);
+					writeValue<uint32_t>(out, (uint32_t)data.indexCount);
+					writeBytes(out, vertices, vertexSize);
+					if (data.indexCount > 0) {
+						writeBytes(out, indices, data.indexCount * sizeof(unsigned short));
+					}
+				}
+			}
+		}
+	}
+	return out;
+}
+
+bool FrameCapture::writeToFile(std::vector<RenderQueue>& renderGroups, const std::string& path)
+{
+	return FileUtils::getInstance()->writeStringToFile(serialize(renderGroups), path);
+}
+
+namespace {
+
+// bounds checked cursor over the capture
+class FrameReader {
+public:
+	FrameReader(uint8_t* data, size_t size) : _cursor(data), _end(data + size), _valid(true) {}
+
+	template <typename T>
+	T read() {
+		T value;
+		memset(&value, 0, sizeof(T));
+		const uint8_t* bytes = skip(sizeof(T));
+		if (bytes) {
+			memcpy(&value, bytes, sizeof(T));
+		}
+		return value;
+	}
+
+	Rect readRect() {
+		float x = read<float>(), y = read<float>(), w = read<float>(), h = read<float>();
+		return Rect(x, y, w, h);
+	}
+
+	// returns the current position and moves past size bytes padded to 4, nullptr if the capture is too short
+	uint8_t* skip(size_t size) {
+		size_t padded = (size + 3) & ~(size_t)3;
+		if (!_valid || (size_t)(_end - _cursor) < padded) {
+			_valid = false;
+			return nullptr;
+		}
+		uint8_t* start = _cursor;
+		_cursor += padded;
+		return start;
+	}
+
+	inline bool isValid() const { return _valid; }
+
+private:
+	uint8_t* _cursor;
+	uint8_t* _end;
+	bool _valid;
+};
+
+}
+
+FrameReplay::FrameReplay(Renderer* renderer)
+	: _renderer(renderer)
+	, _skippedCommands(0)
+{
+	CCASSERT(renderer, "Invalid renderer");
+
+	if (renderer->isHeadless()) {
+		GLProgram* program = new (std::nothrow) GLProgram();
+		_programState = GLProgramState::create(program);
+		program->release();
+	}
+	else {
+		_programState = GLProgramState::getOrCreateWithGLProgramName(GLProgram::SHADER_NAME_POSITION_TEXTURE_COLOR_NO_MVP);
+	}
+	_programState->retain();
+}
+
+FrameReplay::~FrameReplay()
+{
+	release();
+	_programState->release();
+}
+
+bool FrameReplay::load(const std::string& path)
+{
+	Data data = FileUtils::getInstance()->getDataFromFile(path);
+	if (data.isNull()) {
+		return false;
+	}
+	return loadFromMemory(data.getBytes(), data.getSize());
+}
+
+bool FrameReplay::loadFromMemory(const void* data, ssize_t size)
+{
+	release();
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+	_buffer.assign(bytes, bytes + size);
+	if (!parse()) {
+		release();
+		return false;
+	}
+	return true;
+}
+
+void FrameReplay::release()
+{
+	for (auto command : _commands) {
+		delete command;
+	}
+	for (auto group : _groups) {
+		delete group;
+	}
+	for (auto material : _materials) {
+		delete material;
+	}
+	for (auto format : _formats) {
+		delete[] format;
+	}
+	_commands.clear();
+	_groups.clear();
+	_groupOfQueue.clear();
+	_materials.clear();
+	_formats.clear();
+	_entries.clear();
+	_buffer.clear();
+	_skippedCommands = 0;
+}
+
+bool FrameReplay::parse()
+{
+	FrameReader reader(_buffer.data(), _buffer.size());
+	if (reader.read<uint32_t>() != FrameCapture::MAGIC || reader.read<uint32_t>() != FrameCapture::VERSION) {
+		return false;
+	}
+	uint32_t queueCount = reader.read<uint32_t>();
+	uint32_t materialCount = reader.read<uint32_t>();
+	uint32_t commandCount = reader.read<uint32_t>();
+
+	for (uint32_t i = 0; i < materialCount && reader.isValid(); i++) {
+		uint32_t id = reader.read<uint32_t>();
+		reader.read<uint32_t>(); // the gl program, only meaningful in the captured process
+		uint32_t textureCount = reader.read<uint32_t>();
+		GLuint textures[MAX_TEXTURES_PER_MATERIAL2D];
+		for (int t = 0; t < MAX_TEXTURES_PER_MATERIAL2D; t++) {
+			textures[t] = reader.read<uint32_t>();
+		}
+		BlendFunc blendFunc;
+		blendFunc.src = reader.read<uint32_t>();
+		blendFunc.dst = reader.read<uint32_t>();
+		MaterialPrimitiveType primitiveType = (MaterialPrimitiveType)reader.read<uint32_t>();
+		bool skipBatching = reader.read<uint32_t>() != 0;
+		reader.read<uint32_t>(); // the palette size, the replay program has no palette
+
+		VertexStreamAttributes format;
+		format.stride = reader.read<uint32_t>();
+		format.count = reader.read<uint32_t>();
+		if (!reader.isValid() || textureCount > MAX_TEXTURES_PER_MATERIAL2D || format.count > GLProgram::VERTEX_ATTRIB_MAX) {
+			return false;
+		}
+		format.infos = new VertexStreamAttribute[format.count];
+		_formats.push_back(format.infos);
+		for (uint32_t a = 0; a < format.count; a++) {
+			VertexStreamAttribute& attribute = format.infos[a];
+			attribute._offset = reader.read<int32_t>();
+			attribute._semantic = reader.read<int32_t>();
+			attribute._type = reader.read<int32_t>();
+			attribute._size = reader.read<int32_t>();
+			attribute._normalize = reader.read<int32_t>() != 0;
+		}
+		format.generateID();
+
+		Material2D* material = new Material2D();
+		material->init(_programState, textures, textureCount, blendFunc, format, primitiveType);
+		// keep the captured id so the commands batch like they did in the captured frame
+		material->_skipBatching = skipBatching;
+		material->_id = id;
+		_materials.push_back(material);
+	}
+
+	for (uint32_t i = 0; i < commandCount && reader.isValid(); i++) {
+		uint32_t queue = reader.read<uint32_t>();
+		reader.read<uint32_t>(); // the sub queue, the renderer puts the command there again
+		RenderCommand::Type type = (RenderCommand::Type)reader.read<uint32_t>();
+		float globalOrder = reader.read<float>();
+		float depth = reader.read<float>();
+		uint32_t flags = reader.read<uint32_t>();
+		if (queue >= queueCount) {
+			return false;
+		}
+
+		RenderCommand* command = nullptr;
+		if (type == RenderCommand::Type::GROUP_COMMAND) {
+			uint32_t groupQueue = reader.read<uint32_t>();
+			if (!reader.isValid() || groupQueue == 0 || groupQueue >= queueCount) {
+				return false;
+			}
+			if (_groupOfQueue.empty()) {
+				_groupOfQueue.resize(queueCount, nullptr);
+			}
+			if (_groupOfQueue[groupQueue]) {
+				return false;
+			}
+			GroupCommand* group = new GroupCommand();
+			group->init(globalOrder);
+			_groups.push_back(group);
+			_groupOfQueue[groupQueue] = group;
+			command = group;
+		}
+		else if (type == RenderCommand::Type::ARBITRARY_VERTEX_COMMAND) {
+			uint32_t materialIndex = reader.read<uint32_t>();
+			Mat4 mv;
+			for (int m = 0; m < 16; m++) {
+				mv.m[m] = reader.read<float>();
+			}
+			uint32_t avcFlags = reader.read<uint32_t>();
+			float depth2D = reader.read<float>();
+			Rect occlusionBounds = reader.readRect();
+			Rect opaqueRect = reader.readRect();
+			uint32_t vertexCount = reader.read<uint32_t>();
+			uint32_t indexCount = reader.read<uint32_t>();
+			if (!reader.isValid() || materialIndex >= _materials.size() || vertexCount == 0) {
+				return false;
+			}
+
+			Material2D* material = _materials[materialIndex];
+			ArbitraryVertexCommand::Data data;
+			data.vertexCount = vertexCount;
+			data.vertexData = reader.skip((size_t)vertexCount * material->getVertexSize());
+			data.indexCount = indexCount;
+			data.indexData = indexCount > 0 ? reinterpret_cast<unsigned short*>(reader.skip(indexCount * sizeof(unsigned short))) : nullptr;
+			if (!reader.isValid()) {
+				return false;
+			}
+
+			ArbitraryVertexCommand* avc = new ArbitraryVertexCommand();
+			avc->init(globalOrder, material, data, mv, (avcFlags & FrameCapture::AVC_TRANSFORM_ON_CPU) != 0, 0);
+			avc->setCompactVertexFormat((avcFlags & FrameCapture::AVC_COMPACT_VERTEX_FORMAT) != 0);
+			if (avcFlags & FrameCapture::AVC_DEPTH_2D) {
+				avc->setDepth2D(depth2D);
+			}
+			if (avcFlags & FrameCapture::AVC_OCCLUSION_BOUNDS) {
+				avc->setOcclusionBounds(occlusionBounds);
+			}
+			if (avcFlags & FrameCapture::AVC_OPAQUE_RECT) {
+				avc->setOpaqueRect(opaqueRect);
+			}
+			// the captured depth, init only computes it with the camera that was visiting back then
+			if (!(avcFlags & FrameCapture::AVC_DEPTH_2D)) {
+				avc->_depth = depth;
+			}
+			_commands.push_back(avc);
+			command = avc;
+		}
+		else {
+			_skippedCommands++;
+			continue;
+		}
+
+		command->set3D((flags & FrameCapture::COMMAND_3D) != 0);
+		command->setTransparent((flags & FrameCapture::COMMAND_TRANSPARENT) != 0);
+		command->setSkipBatching((flags & FrameCapture::COMMAND_SKIP_BATCHING) != 0);
+		_entries.push_back({ command, (int)queue });
+	}
+	return reader.isValid();
+}
+
+void FrameReplay::submit()
+{
+	for (auto& entry : _entries) {
+		int queue = 0;
+		if (entry.queue != 0) {
+			// a queue without group command was not reachable in the captured frame either
+			if (_groupOfQueue.empty() || _groupOfQueue[entry.queue] == nullptr) {
+				continue;
+			}
+			queue = _groupOfQueue[entry.queue]->getRenderQueueID();
+		}
+		_renderer->addCommand(entry.command, queue);
+	}
+}
+
+NS_CC_END
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "platform/CCPlatformMacros.h"
+#include "renderer/CCArbitraryVertexCommand.h"
+#include "renderer/CCGroupCommand.h"
+
+NS_CC_BEGIN
+
+class Renderer;
+class RenderQueue;
+
+/* Binary frame capture file, all values are 32 bit in native byte order:
+header: magic 'CCFC', version, render queue count, material count, command count
+material: id, gl program, texture count, MAX_TEXTURES_PER_MATERIAL2D texture names, blend src, blend dst, primitive type, skip batching, palette size,
+	vertex stride, attribute count, then offset, semantic, type, size, normalize per attribute
+command: render queue, sub queue, type, global order, depth, flags (3d, transparent, skip batching)
+	group commands: the render queue of the group
+	arbitrary vertex commands: material index, model view (16 floats), avc flags, depth 2d, occlusion bounds, opaque rect,
+		vertex count, index count, the vertices and the indices, each padded to 4 bytes
+	other commands only record their place, their callbacks cant be captured
+The commands are stored in the sorted order of their queues */
+class CC_DLL FrameCapture {
+public:
+	static const uint32_t MAGIC = 0x43464343;
+	static const uint32_t VERSION = 1;
+
+	enum CommandFlags {
+		COMMAND_3D = 1 << 0,
+		COMMAND_TRANSPARENT = 1 << 1,
+		COMMAND_SKIP_BATCHING = 1 << 2,
+	};
+
+	enum ArbitraryVertexCommandFlags {
+		AVC_TRANSFORM_ON_CPU = 1 << 0,
+		AVC_COMPACT_VERTEX_FORMAT = 1 << 1,
+		AVC_DEPTH_2D = 1 << 2,
+		AVC_OCCLUSION_BOUNDS = 1 << 3,
+		AVC_OPAQUE_RECT = 1 << 4,
+	};
+
+	// serializes the sorted render queues of a frame
+	static std::string serialize(std::vector<RenderQueue>& renderGroups);
+	static bool writeToFile(std::vector<RenderQueue>& renderGroups, const std::string& path);
+
+protected:
+	static void writeMaterial(std::string& out, Material2D* material);
+};
+
+/* Rebuilds the commands of a captured frame so it can be rendered any number of times with Renderer::render.
+The file is read once and the commands point into it, nothing is copied per frame.
+Every material uses the same program state, it is never compiled when the renderer is headless. The captured material ids are kept so the
+commands batch exactly like in the captured frame. Commands other than ArbitraryVertexCommand and GroupCommand are not replayed.
+GroupCommands register themselves with the director's renderer, so captures with groups must be replayed with that renderer */
+class CC_DLL FrameReplay {
+public:
+	FrameReplay(Renderer* renderer);
+	~FrameReplay();
+
+	// returns false if the file could not be read or is not a valid capture
+	bool load(const std::string& path);
+	bool loadFromMemory(const void* data, ssize_t size);
+
+	// adds the commands of the frame to the renderer, call before every Renderer::render
+	void submit();
+
+	inline ssize_t getCommandCount() const { return _entries.size(); }
+	// the number of captured commands that cant be replayed
+	inline ssize_t getSkippedCommandCount() const { return _skippedCommands; }
+
+protected:
+	struct Entry {
+		RenderCommand* command;
+		int queue; // the captured render queue
+	};
+
+	bool parse();
+	void release();
+
+	Renderer* _renderer;
+	GLProgramState* _programState;
+	std::vector<uint8_t> _buffer;
+	std::vector<Material2D*> _materials;
+	std::vector<VertexStreamAttribute*> _formats;
+	std::vector<ArbitraryVertexCommand*> _commands;
+	std::vector<GroupCommand*> _groups;
+	std::vector<GroupCommand*> _groupOfQueue; // captured render queue -> the group command replaying it
+	std::vector<Entry> _entries;
+	ssize_t _skippedCommands;
+};
+
+NS_CC_END
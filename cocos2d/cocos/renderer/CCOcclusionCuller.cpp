@@ -0,0 +1,123 @@
+#include "renderer/CCOcclusionCuller.h"
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+NS_CC_BEGIN
+
+const int OcclusionCuller::DEFAULT_TILE_SIZE;
+
+OcclusionCuller::OcclusionCuller()
+	: _tileSize(DEFAULT_TILE_SIZE)
+	, _columns(0)
+	, _rows(0)
+	, _wordsPerRow(0)
+	, _hasOccluders(false)
+{
+}
+
+void OcclusionCuller::begin(const Rect& area)
+{
+	_origin = area.origin;
+	_columns = std::max((int)ceilf(area.size.width / _tileSize), 0);
+	_rows = std::max((int)ceilf(area.size.height / _tileSize), 0);
+	_wordsPerRow = (_columns + 63) / 64;
+	_mask.assign(_wordsPerRow * _rows, 0);
+	_hasOccluders = false;
+}
+
+bool OcclusionCuller::getTileRange(const Rect& rect, bool inner, int& x0, int& y0, int& x1, int& y1, bool* clamped) const
+{
+	float minX = (rect.getMinX() - _origin.x) / _tileSize;
+	float minY = (rect.getMinY() - _origin.y) / _tileSize;
+	float maxX = (rect.getMaxX() - _origin.x) / _tileSize;
+	float maxY = (rect.getMaxY() - _origin.y) / _tileSize;
+
+	// inner: only tiles completely inside, otherwise every tile touched. x1 and y1 are exclusive
+	if (inner) {
+		x0 = (int)ceilf(minX);
+		y0 = (int)ceilf(minY);
+		x1 = (int)floorf(maxX);
+		y1 = (int)floorf(maxY);
+	}
+	else {
+		x0 = (int)floorf(minX);
+		y0 = (int)floorf(minY);
+		x1 = (int)ceilf(maxX);
+		y1 = (int)ceilf(maxY);
+	}
+	if (clamped) {
+		*clamped = x0 < 0 || y0 < 0 || x1 > _columns || y1 > _rows;
+	}
+	x0 = std::max(x0, 0);
+	y0 = std::max(y0, 0);
+	x1 = std::min(x1, _columns);
+	y1 = std::min(y1, _rows);
+	return x0 < x1 && y0 < y1;
+}
+
+// the bits of tiles x0..x1-1 within word w
+static inline uint64_t wordMask(int w, int x0, int x1)
+{
+	int start = std::max(x0 - w * 64, 0);
+	int end = std::min(x1 - w * 64, 64);
+	uint64_t high = end == 64 ? ~0ULL : ((1ULL << end) - 1);
+	return high & ~((1ULL << start) - 1);
+}
+
+void OcclusionCuller::addOccluder(const Rect& rect)
+{
+	int x0, y0, x1, y1;
+	if (!getTileRange(rect, true, x0, y0, x1, y1)) {
+		return;
+	}
+	for (int y = y0; y < y1; y++) {
+		uint64_t* row = &_mask[y * _wordsPerRow];
+		for (int w = x0 / 64; w <= (x1 - 1) / 64; w++) {
+			row[w] |= wordMask(w, x0, x1);
+		}
+	}
+	_hasOccluders = true;
+}
+
+bool OcclusionCuller::isOccluded(const Rect& bounds) const
+{
+	int x0, y0, x1, y1;
+	bool clamped;
+	// the part outside of the area can be visible under a scrolled or zoomed camera
+	if (!_hasOccluders || !getTileRange(bounds, false, x0, y0, x1, y1, &clamped) || clamped) {
+		return false;
+	}
+	for (int y = y0; y < y1; y++) {
+		const uint64_t* row = &_mask[y * _wordsPerRow];
+		for (int w = x0 / 64; w <= (x1 - 1) / 64; w++) {
+			uint64_t bits = wordMask(w, x0, x1);
+			if ((row[w] & bits) != bits) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+Rect OcclusionCuller::getBoundingRect(const Rect& rect, const Mat4& transform)
+{
+	Vec3 corners[4] = {
+		Vec3(rect.getMinX(), rect.getMinY(), 0),
+		Vec3(rect.getMaxX(), rect.getMinY(), 0),
+		Vec3(rect.getMinX(), rect.getMaxY(), 0),
+		Vec3(rect.getMaxX(), rect.getMaxY(), 0)
+	};
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+	for (auto& corner : corners) {
+		transform.transformPoint(&corner);
+		minX = std::min(minX, corner.x);
+		minY = std::min(minY, corner.y);
+		maxX = std::max(maxX, corner.x);
+		maxY = std::max(maxY, corner.y);
+	}
+	return Rect(minX, minY, maxX - minX, maxY - minY);
+}
+
+NS_CC_END
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "platform/CCPlatformMacros.h"
+#include "math/CCGeometry.h"
+#include "math/Mat4.h"
+
+NS_CC_BEGIN
+
+/* Coarse tile coverage mask for 2d occlusion culling.
+Opaque rects are rasterized front to back, a tile only counts as covered if an occluder covers it completely,
+so everything that isOccluded reports is hidden for sure */
+class CC_DLL OcclusionCuller {
+public:
+	static const int DEFAULT_TILE_SIZE = 32;
+
+	OcclusionCuller();
+
+	inline void setTileSize(float tileSize) { _tileSize = tileSize; }
+	inline float getTileSize() const { return _tileSize; }
+
+	// clears the mask, area is the visible region in the same space as the rects
+	void begin(const Rect& area);
+	// marks the tiles that rect covers completely
+	void addOccluder(const Rect& rect);
+	// whether all tiles of bounds are covered. bounds that reach outside of the area are never occluded,
+	// the mask knows nothing about what is drawn there
+	bool isOccluded(const Rect& bounds) const;
+
+	// the axis aligned bounding rect of rect transformed by transform
+	static Rect getBoundingRect(const Rect& rect, const Mat4& transform);
+
+protected:
+	// the tiles rect touches, clamped to the area. returns false if none, clamped is set if the range was cut by the area
+	bool getTileRange(const Rect& rect, bool inner, int& x0, int& y0, int& x1, int& y1, bool* clamped = nullptr) const;
+
+	float _tileSize;
+	Vec2 _origin;
+	int _columns;
+	int _rows;
+	int _wordsPerRow;
+	std::vector<uint64_t> _mask;
+	bool _hasOccluders;
+};
+
+NS_CC_END
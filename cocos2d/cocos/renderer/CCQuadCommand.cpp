@@ -49,24 +49,8 @@ QuadCommand::QuadCommand()
 	_type = RenderCommand::Type::ARBITRARY_VERTEX_COMMAND;
 }
 
-static VertexStreamAttributes* s_triangleAttributes = nullptr;
-
 static unsigned short* s_indices = nullptr;
 
-static VertexStreamAttributes* getTriangleAttributes() {
-	if (s_triangleAttributes == nullptr) {
-		s_triangleAttributes = new VertexStreamAttributes();
-		s_triangleAttributes->infos = new VertexStreamAttribute[3];
-		s_triangleAttributes->infos[0] = VertexStreamAttribute(0, GLProgram::VERTEX_ATTRIB_POSITION, GL_FLOAT, 3, false);
-		s_triangleAttributes->infos[1] = VertexStreamAttribute(12, GLProgram::VERTEX_ATTRIB_COLOR, GL_UNSIGNED_BYTE, 4, true);
-		s_triangleAttributes->infos[2] = VertexStreamAttribute(16, GLProgram::VERTEX_ATTRIB_TEX_COORD, GL_FLOAT, 2, false);
-		s_triangleAttributes->stride = 24;
-		s_triangleAttributes->count = 3;
-		s_triangleAttributes->generateID();
-	}
-	return s_triangleAttributes;
-}
-
 void QuadCommand::setStaticIndices(unsigned short* indices) {
 	s_indices = indices;
 }
@@ -87,7 +71,7 @@ void QuadCommand::init(float globalOrder, GLuint textureID, GLProgramState* shad
 		_blendType = blendType;
 		_glProgramState = shader;
 
-		_tmpMaterial->init(_glProgramState, &textureID, 1, blendType, *getTriangleAttributes(), MaterialPrimitiveType::TRIANGLE);
+		_tmpMaterial->init(_glProgramState, &textureID, 1, blendType, *VertexStreamAttributes::getV3F_C4B_T2F(), MaterialPrimitiveType::TRIANGLE);
 	}
 
 	ArbitraryVertexCommand::Data data;
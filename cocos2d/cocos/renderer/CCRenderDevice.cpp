@@ -0,0 +1,504 @@
+#include "renderer/CCRenderDevice.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "renderer/CCGLProgramState.h"
+
+NS_CC_BEGIN
+
+// RenderDevice
+
+RenderDevice* RenderDevice::getDefault()
+{
+	static RenderDevice s_defaultDevice;
+	return &s_defaultDevice;
+}
+
+const signed char RenderDevice::SHADOW_UNKNOWN;
+
+void RenderDevice::invalidateStateCache()
+{
+	memset(_shadow, SHADOW_UNKNOWN, sizeof(_shadow));
+	if (_backend) _backend->invalidateStateCache();
+}
+
+int RenderDevice::getShadowIndex(GLenum cap)
+{
+	switch (cap) {
+	case GL_DEPTH_TEST: return SHADOW_DEPTH_TEST;
+	case GL_CULL_FACE: return SHADOW_CULL_FACE;
+	case GL_BLEND: return SHADOW_BLEND;
+	default: return -1;
+	}
+}
+
+void RenderDevice::setCap(GLenum cap, bool enabled)
+{
+	int index = getShadowIndex(cap);
+	if (index >= 0) {
+		if (_shadow[index] == (signed char)enabled) {
+			_stateStats.skippedToggles++;
+			return;
+		}
+		_shadow[index] = enabled;
+	}
+	_stateStats.toggles++;
+
+	if (_backend) {
+		if (enabled) _backend->enable(cap);
+		else _backend->disable(cap);
+	}
+	else {
+		if (enabled) glEnable(cap);
+		else glDisable(cap);
+	}
+}
+
+void RenderDevice::enable(GLenum cap)
+{
+	setCap(cap, true);
+}
+
+void RenderDevice::disable(GLenum cap)
+{
+	setCap(cap, false);
+}
+
+void RenderDevice::depthMask(GLboolean flag)
+{
+	signed char value = flag != GL_FALSE;
+	if (_shadow[SHADOW_DEPTH_MASK] == value) {
+		_stateStats.skippedToggles++;
+		return;
+	}
+	_shadow[SHADOW_DEPTH_MASK] = value;
+	_stateStats.toggles++;
+
+	if (_backend) _backend->depthMask(flag);
+	else glDepthMask(flag);
+}
+
+bool RenderDevice::isEnabled(GLenum cap)
+{
+	int index = getShadowIndex(cap);
+	if (index >= 0 && _shadow[index] != SHADOW_UNKNOWN) {
+		_stateStats.skippedQueries++;
+		return _shadow[index] != 0;
+	}
+	_stateStats.queries++;
+
+	bool enabled;
+	if (_backend) enabled = _backend->isEnabled(cap);
+	else enabled = glIsEnabled(cap) != GL_FALSE;
+
+	if (index >= 0) {
+		_shadow[index] = enabled;
+	}
+	return enabled;
+}
+
+void RenderDevice::getBooleanv(GLenum pname, GLboolean* data)
+{
+	if (pname == GL_DEPTH_WRITEMASK && _shadow[SHADOW_DEPTH_MASK] != SHADOW_UNKNOWN) {
+		_stateStats.skippedQueries++;
+		*data = _shadow[SHADOW_DEPTH_MASK] ? GL_TRUE : GL_FALSE;
+		return;
+	}
+	_stateStats.queries++;
+
+	if (_backend) _backend->getBooleanv(pname, data);
+	else glGetBooleanv(pname, data);
+
+	if (pname == GL_DEPTH_WRITEMASK) {
+		_shadow[SHADOW_DEPTH_MASK] = *data != GL_FALSE;
+	}
+}
+
+void RenderDevice::applyProgram(GLProgramState* programState, const Mat4& modelView)
+{
+	if (_backend) {
+		_backend->applyProgram(programState, modelView);
+	}
+	else {
+		programState->applyGLProgram(modelView);
+		programState->applyUniforms();
+	}
+}
+
+void RenderDevice::drawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLint baseVertex)
+{
+	if (_backend) {
+		_backend->drawElementsBaseVertex(mode, count, type, indices, baseVertex);
+	}
+	else {
+#if CC_RENDERER_BASE_VERTEX
+		glDrawElementsBaseVertex(mode, count, type, indices, baseVertex);
+#else
+		CCASSERT(false, "base vertex draws are not supported on this platform");
+#endif
+	}
+}
+
+void RenderDevice::multiDrawElementsBaseVertex(GLenum mode, const GLsizei* count, GLenum type, const GLvoid* const* indices, GLsizei drawCount, const GLint* baseVertex)
+{
+	if (_backend) {
+		_backend->multiDrawElementsBaseVertex(mode, count, type, indices, drawCount, baseVertex);
+	}
+	else {
+#if CC_RENDERER_BASE_VERTEX
+		glMultiDrawElementsBaseVertex(mode, count, type, indices, drawCount, baseVertex);
+#else
+		CCASSERT(false, "base vertex draws are not supported on this platform");
+#endif
+	}
+}
+
+void RenderDevice::vertexAttribDivisor(GLuint index, GLuint divisor)
+{
+	if (_backend) {
+		_backend->vertexAttribDivisor(index, divisor);
+	}
+	else {
+#if CC_RENDERER_INSTANCING
+		glVertexAttribDivisor(index, divisor);
+#else
+		CCASSERT(false, "instanced draws are not supported on this platform");
+#endif
+	}
+}
+
+void RenderDevice::drawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLsizei instanceCount)
+{
+	if (_backend) {
+		_backend->drawElementsInstanced(mode, count, type, indices, instanceCount);
+	}
+	else {
+#if CC_RENDERER_INSTANCING
+		glDrawElementsInstanced(mode, count, type, indices, instanceCount);
+#else
+		CCASSERT(false, "instanced draws are not supported on this platform");
+#endif
+	}
+}
+
+// NullRenderDeviceBackend
+
+NullRenderDeviceBackend::NullRenderDeviceBackend()
+	: _nextBuffer(1)
+{
+}
+
+void NullRenderDeviceBackend::genBuffers(GLsizei n, GLuint* buffers)
+{
+	for (GLsizei i = 0; i < n; i++) {
+		buffers[i] = _nextBuffer++;
+	}
+}
+
+void NullRenderDeviceBackend::bufferData(GLenum target, GLsizeiptr size, const GLvoid* data, GLenum usage)
+{
+	if (data == nullptr && (size_t)size > _mapScratch.size()) {
+		_mapScratch.resize(size);
+	}
+}
+
+void* NullRenderDeviceBackend::mapBuffer(GLenum target, GLenum access)
+{
+	return _mapScratch.data();
+}
+
+// RecordingRenderDeviceBackend
+
+RecordingRenderDeviceBackend::RecordingRenderDeviceBackend(bool forwardToGL)
+	: _forwardToGL(forwardToGL)
+	, _mappedSize(0)
+{
+	if (!forwardToGL) {
+		_gl.setBackend(&_null);
+	}
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+void RecordingRenderDeviceBackend::beginFrame()
+{
+	_calls.clear();
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+void RecordingRenderDeviceBackend::record(Call call, intptr_t a0, intptr_t a1, intptr_t a2, intptr_t a3, intptr_t a4, intptr_t a5)
+{
+	RecordedCall recorded = { call, { a0, a1, a2, a3, a4, a5 } };
+	_calls.push_back(recorded);
+	_stats.calls++;
+}
+
+void RecordingRenderDeviceBackend::genBuffers(GLsizei n, GLuint* buffers)
+{
+	_gl.genBuffers(n, buffers);
+	record(Call::GEN_BUFFERS, n, n > 0 ? buffers[0] : 0);
+}
+
+void RecordingRenderDeviceBackend::deleteBuffers(GLsizei n, const GLuint* buffers)
+{
+	record(Call::DELETE_BUFFERS, n, n > 0 ? buffers[0] : 0);
+	_gl.deleteBuffers(n, buffers);
+}
+
+void RecordingRenderDeviceBackend::bindBuffer(GLenum target, GLuint buffer)
+{
+	record(Call::BIND_BUFFER, target, buffer);
+	_stats.stateChanges++;
+	_gl.bindBuffer(target, buffer);
+}
+
+void RecordingRenderDeviceBackend::bufferData(GLenum target, GLsizeiptr size, const GLvoid* data, GLenum usage)
+{
+	record(Call::BUFFER_DATA, target, size, (intptr_t)data, usage);
+	if (data != nullptr) {
+		_stats.uploadedBytes += size;
+	}
+	else {
+		_mappedSize = size;
+	}
+	_gl.bufferData(target, size, data, usage);
+}
+
+void RecordingRenderDeviceBackend::bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid* data)
+{
+	record(Call::BUFFER_SUB_DATA, target, offset, size, (intptr_t)data);
+	_stats.uploadedBytes += size;
+	_gl.bufferSubData(target, offset, size, data);
+}
+
+void* RecordingRenderDeviceBackend::mapBuffer(GLenum target, GLenum access)
+{
+	record(Call::MAP_BUFFER, target, access);
+	return _gl.mapBuffer(target, access);
+}
+
+void RecordingRenderDeviceBackend::unmapBuffer(GLenum target)
+{
+	record(Call::UNMAP_BUFFER, target);
+	// the whole mapped range is treated as written
+	_stats.uploadedBytes += _mappedSize;
+	_mappedSize = 0;
+	_gl.unmapBuffer(target);
+}
+
+void RecordingRenderDeviceBackend::enableVertexAttribs(uint32_t flags)
+{
+	record(Call::ENABLE_VERTEX_ATTRIBS, flags);
+	_stats.stateChanges++;
+	_gl.enableVertexAttribs(flags);
+}
+
+void RecordingRenderDeviceBackend::vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const GLvoid* pointer)
+{
+	record(Call::VERTEX_ATTRIB_POINTER, index, size, type, normalized, stride, (intptr_t)pointer);
+	_stats.stateChanges++;
+	_gl.vertexAttribPointer(index, size, type, normalized, stride, pointer);
+}
+
+void RecordingRenderDeviceBackend::enableVertexAttribArray(GLuint index)
+{
+	record(Call::ENABLE_VERTEX_ATTRIB_ARRAY, index);
+	_stats.stateChanges++;
+	_gl.enableVertexAttribArray(index);
+}
+
+void RecordingRenderDeviceBackend::disableVertexAttribArray(GLuint index)
+{
+	record(Call::DISABLE_VERTEX_ATTRIB_ARRAY, index);
+	_stats.stateChanges++;
+	_gl.disableVertexAttribArray(index);
+}
+
+void RecordingRenderDeviceBackend::vertexAttribDivisor(GLuint index, GLuint divisor)
+{
+	record(Call::VERTEX_ATTRIB_DIVISOR, index, divisor);
+	_stats.stateChanges++;
+	_gl.vertexAttribDivisor(index, divisor);
+}
+
+void RecordingRenderDeviceBackend::bindTexture2DN(GLuint textureUnit, GLuint textureId)
+{
+	record(Call::BIND_TEXTURE_2D_N, textureUnit, textureId);
+	_stats.stateChanges++;
+	_gl.bindTexture2DN(textureUnit, textureId);
+}
+
+void RecordingRenderDeviceBackend::blendFunc(GLenum src, GLenum dst)
+{
+	record(Call::BLEND_FUNC, src, dst);
+	_stats.stateChanges++;
+	_gl.blendFunc(src, dst);
+}
+
+void RecordingRenderDeviceBackend::applyProgram(GLProgramState* programState, const Mat4& modelView)
+{
+	record(Call::APPLY_PROGRAM, (intptr_t)programState);
+	_stats.stateChanges++;
+	_gl.applyProgram(programState, modelView);
+}
+
+void RecordingRenderDeviceBackend::uniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value)
+{
+	record(Call::UNIFORM_MATRIX_4FV, location, count, transpose, (intptr_t)value);
+	_stats.stateChanges++;
+	_gl.uniformMatrix4fv(location, count, transpose, value);
+}
+
+void RecordingRenderDeviceBackend::enable(GLenum cap)
+{
+	record(Call::ENABLE, cap);
+	_stats.stateChanges++;
+	_gl.enable(cap);
+}
+
+void RecordingRenderDeviceBackend::disable(GLenum cap)
+{
+	record(Call::DISABLE, cap);
+	_stats.stateChanges++;
+	_gl.disable(cap);
+}
+
+void RecordingRenderDeviceBackend::depthMask(GLboolean flag)
+{
+	record(Call::DEPTH_MASK, flag);
+	_stats.stateChanges++;
+	_gl.depthMask(flag);
+}
+
+void RecordingRenderDeviceBackend::depthFunc(GLenum func)
+{
+	record(Call::DEPTH_FUNC, func);
+	_stats.stateChanges++;
+	_gl.depthFunc(func);
+}
+
+bool RecordingRenderDeviceBackend::isEnabled(GLenum cap)
+{
+	record(Call::IS_ENABLED, cap);
+	return _gl.isEnabled(cap);
+}
+
+void RecordingRenderDeviceBackend::getBooleanv(GLenum pname, GLboolean* data)
+{
+	record(Call::GET_BOOLEANV, pname);
+	_gl.getBooleanv(pname, data);
+}
+
+static intptr_t floatBits(GLclampf value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+void RecordingRenderDeviceBackend::clearColor(GLclampf r, GLclampf g, GLclampf b, GLclampf a)
+{
+	record(Call::CLEAR_COLOR, floatBits(r), floatBits(g), floatBits(b), floatBits(a));
+	_stats.stateChanges++;
+	_gl.clearColor(r, g, b, a);
+}
+
+void RecordingRenderDeviceBackend::clearDepth(GLclampf depth)
+{
+	record(Call::CLEAR_DEPTH, floatBits(depth));
+	_stats.stateChanges++;
+	_gl.clearDepth(depth);
+}
+
+void RecordingRenderDeviceBackend::clear(GLbitfield mask)
+{
+	record(Call::CLEAR, mask);
+	_gl.clear(mask);
+}
+
+void RecordingRenderDeviceBackend::drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices)
+{
+	record(Call::DRAW_ELEMENTS, mode, count, type, (intptr_t)indices);
+	_stats.draws++;
+	_gl.drawElements(mode, count, type, indices);
+}
+
+void RecordingRenderDeviceBackend::drawArrays(GLenum mode, GLint first, GLsizei count)
+{
+	record(Call::DRAW_ARRAYS, mode, first, count);
+	_stats.draws++;
+	_gl.drawArrays(mode, first, count);
+}
+
+void RecordingRenderDeviceBackend::drawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLint baseVertex)
+{
+	record(Call::DRAW_ELEMENTS_BASE_VERTEX, mode, count, type, (intptr_t)indices, baseVertex);
+	_stats.draws++;
+	_gl.drawElementsBaseVertex(mode, count, type, indices, baseVertex);
+}
+
+void RecordingRenderDeviceBackend::multiDrawElementsBaseVertex(GLenum mode, const GLsizei* count, GLenum type, const GLvoid* const* indices, GLsizei drawCount, const GLint* baseVertex)
+{
+	record(Call::MULTI_DRAW_ELEMENTS_BASE_VERTEX, mode, type, drawCount);
+	_stats.draws++;
+	_gl.multiDrawElementsBaseVertex(mode, count, type, indices, drawCount, baseVertex);
+}
+
+void RecordingRenderDeviceBackend::drawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLsizei instanceCount)
+{
+	record(Call::DRAW_ELEMENTS_INSTANCED, mode, count, type, (intptr_t)indices, instanceCount);
+	_stats.draws++;
+	_gl.drawElementsInstanced(mode, count, type, indices, instanceCount);
+}
+
+const char* RecordingRenderDeviceBackend::getCallName(Call call)
+{
+	switch (call) {
+	case Call::GEN_BUFFERS: return "genBuffers";
+	case Call::DELETE_BUFFERS: return "deleteBuffers";
+	case Call::BIND_BUFFER: return "bindBuffer";
+	case Call::BUFFER_DATA: return "bufferData";
+	case Call::BUFFER_SUB_DATA: return "bufferSubData";
+	case Call::MAP_BUFFER: return "mapBuffer";
+	case Call::UNMAP_BUFFER: return "unmapBuffer";
+	case Call::ENABLE_VERTEX_ATTRIBS: return "enableVertexAttribs";
+	case Call::VERTEX_ATTRIB_POINTER: return "vertexAttribPointer";
+	case Call::ENABLE_VERTEX_ATTRIB_ARRAY: return "enableVertexAttribArray";
+	case Call::DISABLE_VERTEX_ATTRIB_ARRAY: return "disableVertexAttribArray";
+	case Call::VERTEX_ATTRIB_DIVISOR: return "vertexAttribDivisor";
+	case Call::BIND_TEXTURE_2D_N: return "bindTexture2DN";
+	case Call::BLEND_FUNC: return "blendFunc";
+	case Call::APPLY_PROGRAM: return "applyProgram";
+	case Call::UNIFORM_MATRIX_4FV: return "uniformMatrix4fv";
+	case Call::ENABLE: return "enable";
+	case Call::DISABLE: return "disable";
+	case Call::DEPTH_MASK: return "depthMask";
+	case Call::DEPTH_FUNC: return "depthFunc";
+	case Call::IS_ENABLED: return "isEnabled";
+	case Call::GET_BOOLEANV: return "getBooleanv";
+	case Call::CLEAR_COLOR: return "clearColor";
+	case Call::CLEAR_DEPTH: return "clearDepth";
+	case Call::CLEAR: return "clear";
+	case Call::DRAW_ELEMENTS: return "drawElements";
+	case Call::DRAW_ARRAYS: return "drawArrays";
+	case Call::DRAW_ELEMENTS_BASE_VERTEX: return "drawElementsBaseVertex";
+	case Call::MULTI_DRAW_ELEMENTS_BASE_VERTEX: return "multiDrawElementsBaseVertex";
+	case Call::DRAW_ELEMENTS_INSTANCED: return "drawElementsInstanced";
+	}
+	return "unknown";
+}
+
+std::string RecordingRenderDeviceBackend::dump() const
+{
+	std::string result;
+	char buffer[256];
+	for (auto& call : _calls) {
+		snprintf(buffer, sizeof(buffer), "%s(%lld, %lld, %lld, %lld, %lld, %lld)\n", getCallName(call.call),
+			(long long)call.args[0], (long long)call.args[1], (long long)call.args[2],
+			(long long)call.args[3], (long long)call.args[4], (long long)call.args[5]);
+		result += buffer;
+	}
+	return result;
+}
+
+NS_CC_END
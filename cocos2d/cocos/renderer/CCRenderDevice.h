@@ -0,0 +1,386 @@
+#pragma once
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "platform/CCPlatformMacros.h"
+#include "platform/CCGL.h"
+#include "base/ccTypes.h"
+#include "renderer/ccGLStateCache.h"
+
+// base vertex draws need gl 3.2 or ARB_draw_elements_base_vertex, whose entry points are only loaded on desktop platforms
+#if (CC_TARGET_PLATFORM == CC_PLATFORM_WIN32 || CC_TARGET_PLATFORM == CC_PLATFORM_MAC || CC_TARGET_PLATFORM == CC_PLATFORM_LINUX)
+#define CC_RENDERER_BASE_VERTEX 1
+#else
+#define CC_RENDERER_BASE_VERTEX 0
+#endif
+
+// instanced draws need gl 3.3 or ARB_instanced_arrays, same platforms as above
+#if (CC_TARGET_PLATFORM == CC_PLATFORM_WIN32 || CC_TARGET_PLATFORM == CC_PLATFORM_MAC || CC_TARGET_PLATFORM == CC_PLATFORM_LINUX)
+#define CC_RENDERER_INSTANCING 1
+#else
+#define CC_RENDERER_INSTANCING 0
+#endif
+
+NS_CC_BEGIN
+
+class GLProgramState;
+
+// receives every gl call the renderer makes when set on a RenderDevice
+class CC_DLL RenderDeviceBackend {
+public:
+	virtual ~RenderDeviceBackend() {}
+
+	// called at the beginning of every Renderer::render
+	virtual void beginFrame() {}
+	// called when the device drops its shadow state, a backend that shadows state itself has to drop it too
+	virtual void invalidateStateCache() {}
+
+	virtual void genBuffers(GLsizei n, GLuint* buffers) = 0;
+	virtual void deleteBuffers(GLsizei n, const GLuint* buffers) = 0;
+	virtual void bindBuffer(GLenum target, GLuint buffer) = 0;
+	virtual void bufferData(GLenum target, GLsizeiptr size, const GLvoid* data, GLenum usage) = 0;
+	virtual void bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid* data) = 0;
+	virtual void* mapBuffer(GLenum target, GLenum access) = 0;
+	virtual void unmapBuffer(GLenum target) = 0;
+
+	virtual void enableVertexAttribs(uint32_t flags) = 0;
+	virtual void vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const GLvoid* pointer) = 0;
+	// for attributes outside of the ones the gl state cache manages
+	virtual void enableVertexAttribArray(GLuint index) = 0;
+	virtual void disableVertexAttribArray(GLuint index) = 0;
+	virtual void vertexAttribDivisor(GLuint index, GLuint divisor) = 0;
+	virtual void bindTexture2DN(GLuint textureUnit, GLuint textureId) = 0;
+	virtual void blendFunc(GLenum src, GLenum dst) = 0;
+	virtual void applyProgram(GLProgramState* programState, const Mat4& modelView) = 0;
+	virtual void uniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value) = 0;
+
+	virtual void enable(GLenum cap) = 0;
+	virtual void disable(GLenum cap) = 0;
+	virtual void depthMask(GLboolean flag) = 0;
+	virtual void depthFunc(GLenum func) = 0;
+	virtual bool isEnabled(GLenum cap) = 0;
+	virtual void getBooleanv(GLenum pname, GLboolean* data) = 0;
+
+	virtual void clearColor(GLclampf r, GLclampf g, GLclampf b, GLclampf a) = 0;
+	virtual void clearDepth(GLclampf depth) = 0;
+	virtual void clear(GLbitfield mask) = 0;
+
+	virtual void drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices) = 0;
+	virtual void drawArrays(GLenum mode, GLint first, GLsizei count) = 0;
+	virtual void drawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLint baseVertex) = 0;
+	virtual void multiDrawElementsBaseVertex(GLenum mode, const GLsizei* count, GLenum type, const GLvoid* const* indices, GLsizei drawCount, const GLint* baseVertex) = 0;
+	virtual void drawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLsizei instanceCount) = 0;
+};
+
+// how many state changes and queries the shadow state of a RenderDevice kept from gl
+struct RenderDeviceStateStats {
+	int toggles; // enable, disable and depthMask calls that reached gl
+	int skippedToggles;
+	int queries; // isEnabled and getBooleanv calls that reached gl
+	int skippedQueries;
+};
+
+/* The layer between the renderer and gl. Without a backend every call goes straight to gl (or the gl state cache) and is inlined,
+with a backend set every call is forwarded to it instead.
+Depth test, cull face, blend and the depth mask are shadowed: redundant changes are dropped and queries answered from the shadow.
+A state is unknown until it is set or queried once. Code that changes these states with raw gl has to call invalidateStateCache */
+class CC_DLL RenderDevice {
+public:
+	RenderDevice() : _backend(nullptr) {
+		invalidateStateCache();
+		clearStateStats();
+	}
+
+	// nullptr makes the device talk to gl directly
+	void setBackend(RenderDeviceBackend* backend) { _backend = backend; }
+	RenderDeviceBackend* getBackend() const { return _backend; }
+
+	// a device without backend, used by code that has no renderer at hand
+	static RenderDevice* getDefault();
+
+	// also invalidates the state cache, as anything could have happened between frames
+	inline void beginFrame() {
+		invalidateStateCache();
+		if (_backend) _backend->beginFrame();
+	}
+
+	void invalidateStateCache();
+	const RenderDeviceStateStats& getStateStats() const { return _stateStats; }
+	void clearStateStats() { memset(&_stateStats, 0, sizeof(_stateStats)); }
+
+	inline void genBuffers(GLsizei n, GLuint* buffers) {
+		if (_backend) _backend->genBuffers(n, buffers);
+		else glGenBuffers(n, buffers);
+	}
+	inline void deleteBuffers(GLsizei n, const GLuint* buffers) {
+		if (_backend) _backend->deleteBuffers(n, buffers);
+		else glDeleteBuffers(n, buffers);
+	}
+	inline void bindBuffer(GLenum target, GLuint buffer) {
+		if (_backend) _backend->bindBuffer(target, buffer);
+		else glBindBuffer(target, buffer);
+	}
+	inline void bufferData(GLenum target, GLsizeiptr size, const GLvoid* data, GLenum usage) {
+		if (_backend) _backend->bufferData(target, size, data, usage);
+		else glBufferData(target, size, data, usage);
+	}
+	inline void bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid* data) {
+		if (_backend) _backend->bufferSubData(target, offset, size, data);
+		else glBufferSubData(target, offset, size, data);
+	}
+	inline void* mapBuffer(GLenum target, GLenum access) {
+		if (_backend) return _backend->mapBuffer(target, access);
+		return glMapBuffer(target, access);
+	}
+	inline void unmapBuffer(GLenum target) {
+		if (_backend) _backend->unmapBuffer(target);
+		else glUnmapBuffer(target);
+	}
+
+	inline void enableVertexAttribs(uint32_t flags) {
+		if (_backend) _backend->enableVertexAttribs(flags);
+		else GL::enableVertexAttribs(flags);
+	}
+	inline void vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const GLvoid* pointer) {
+		if (_backend) _backend->vertexAttribPointer(index, size, type, normalized, stride, pointer);
+		else glVertexAttribPointer(index, size, type, normalized, stride, pointer);
+	}
+	inline void enableVertexAttribArray(GLuint index) {
+		if (_backend) _backend->enableVertexAttribArray(index);
+		else glEnableVertexAttribArray(index);
+	}
+	inline void disableVertexAttribArray(GLuint index) {
+		if (_backend) _backend->disableVertexAttribArray(index);
+		else glDisableVertexAttribArray(index);
+	}
+	void vertexAttribDivisor(GLuint index, GLuint divisor);
+	inline void bindTexture2DN(GLuint textureUnit, GLuint textureId) {
+		if (_backend) _backend->bindTexture2DN(textureUnit, textureId);
+		else GL::bindTexture2DN(textureUnit, textureId);
+	}
+	inline void blendFunc(GLenum src, GLenum dst) {
+		if (_backend) _backend->blendFunc(src, dst);
+		else GL::blendFunc(src, dst);
+	}
+	void applyProgram(GLProgramState* programState, const Mat4& modelView);
+	inline void uniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value) {
+		if (_backend) _backend->uniformMatrix4fv(location, count, transpose, value);
+		else glUniformMatrix4fv(location, count, transpose, value);
+	}
+
+	void enable(GLenum cap);
+	void disable(GLenum cap);
+	void depthMask(GLboolean flag);
+	inline void depthFunc(GLenum func) {
+		if (_backend) _backend->depthFunc(func);
+		else glDepthFunc(func);
+	}
+	bool isEnabled(GLenum cap);
+	void getBooleanv(GLenum pname, GLboolean* data);
+
+	inline void clearColor(GLclampf r, GLclampf g, GLclampf b, GLclampf a) {
+		if (_backend) _backend->clearColor(r, g, b, a);
+		else glClearColor(r, g, b, a);
+	}
+	inline void clearDepth(GLclampf depth) {
+		if (_backend) _backend->clearDepth(depth);
+		else glClearDepth(depth);
+	}
+	inline void clear(GLbitfield mask) {
+		if (_backend) _backend->clear(mask);
+		else glClear(mask);
+	}
+
+	inline void drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices) {
+		if (_backend) _backend->drawElements(mode, count, type, indices);
+		else glDrawElements(mode, count, type, indices);
+	}
+	inline void drawArrays(GLenum mode, GLint first, GLsizei count) {
+		if (_backend) _backend->drawArrays(mode, first, count);
+		else glDrawArrays(mode, first, count);
+	}
+	void drawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLint baseVertex);
+	void multiDrawElementsBaseVertex(GLenum mode, const GLsizei* count, GLenum type, const GLvoid* const* indices, GLsizei drawCount, const GLint* baseVertex);
+	void drawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLsizei instanceCount);
+
+protected:
+	enum ShadowState {
+		SHADOW_DEPTH_TEST,
+		SHADOW_CULL_FACE,
+		SHADOW_BLEND,
+		SHADOW_DEPTH_MASK,
+		SHADOW_COUNT
+	};
+	static const signed char SHADOW_UNKNOWN = -1;
+
+	// the shadow slot of a capability or -1 if it isnt shadowed
+	static int getShadowIndex(GLenum cap);
+	void setCap(GLenum cap, bool enabled);
+
+	RenderDeviceBackend* _backend;
+
+	signed char _shadow[SHADOW_COUNT]; // SHADOW_UNKNOWN, 0 or 1
+	RenderDeviceStateStats _stateStats;
+};
+
+// swallows every call, used to profile the cpu side of the renderer without a gl context
+class CC_DLL NullRenderDeviceBackend : public RenderDeviceBackend {
+public:
+	NullRenderDeviceBackend();
+
+	virtual void genBuffers(GLsizei n, GLuint* buffers) override;
+	virtual void deleteBuffers(GLsizei n, const GLuint* buffers) override {}
+	virtual void bindBuffer(GLenum target, GLuint buffer) override {}
+	virtual void bufferData(GLenum target, GLsizeiptr size, const GLvoid* data, GLenum usage) override;
+	virtual void bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid* data) override {}
+	virtual void* mapBuffer(GLenum target, GLenum access) override;
+	virtual void unmapBuffer(GLenum target) override {}
+
+	virtual void enableVertexAttribs(uint32_t flags) override {}
+	virtual void vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const GLvoid* pointer) override {}
+	virtual void enableVertexAttribArray(GLuint index) override {}
+	virtual void disableVertexAttribArray(GLuint index) override {}
+	virtual void vertexAttribDivisor(GLuint index, GLuint divisor) override {}
+	virtual void bindTexture2DN(GLuint textureUnit, GLuint textureId) override {}
+	virtual void blendFunc(GLenum src, GLenum dst) override {}
+	virtual void applyProgram(GLProgramState* programState, const Mat4& modelView) override {}
+	virtual void uniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value) override {}
+
+	virtual void enable(GLenum cap) override {}
+	virtual void disable(GLenum cap) override {}
+	virtual void depthMask(GLboolean flag) override {}
+	virtual void depthFunc(GLenum func) override {}
+	virtual bool isEnabled(GLenum cap) override { return false; }
+	virtual void getBooleanv(GLenum pname, GLboolean* data) override { *data = GL_FALSE; }
+
+	virtual void clearColor(GLclampf r, GLclampf g, GLclampf b, GLclampf a) override {}
+	virtual void clearDepth(GLclampf depth) override {}
+	virtual void clear(GLbitfield mask) override {}
+
+	virtual void drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices) override {}
+	virtual void drawArrays(GLenum mode, GLint first, GLsizei count) override {}
+	virtual void drawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLint baseVertex) override {}
+	virtual void multiDrawElementsBaseVertex(GLenum mode, const GLsizei* count, GLenum type, const GLvoid* const* indices, GLsizei drawCount, const GLint* baseVertex) override {}
+	virtual void drawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLsizei instanceCount) override {}
+
+protected:
+	GLuint _nextBuffer;
+	// mapBuffer hands out this memory, sized by the last bufferData call
+	std::vector<char> _mapScratch;
+};
+
+// logs every call with its arguments and counts draws, state changes and uploaded bytes per frame.
+// the calls are either swallowed or, with forwardToGL set, also sent to gl
+class CC_DLL RecordingRenderDeviceBackend : public RenderDeviceBackend {
+public:
+	enum class Call {
+		GEN_BUFFERS,
+		DELETE_BUFFERS,
+		BIND_BUFFER,
+		BUFFER_DATA,
+		BUFFER_SUB_DATA,
+		MAP_BUFFER,
+		UNMAP_BUFFER,
+		ENABLE_VERTEX_ATTRIBS,
+		VERTEX_ATTRIB_POINTER,
+		ENABLE_VERTEX_ATTRIB_ARRAY,
+		DISABLE_VERTEX_ATTRIB_ARRAY,
+		VERTEX_ATTRIB_DIVISOR,
+		BIND_TEXTURE_2D_N,
+		BLEND_FUNC,
+		APPLY_PROGRAM,
+		UNIFORM_MATRIX_4FV,
+		ENABLE,
+		DISABLE,
+		DEPTH_MASK,
+		DEPTH_FUNC,
+		IS_ENABLED,
+		GET_BOOLEANV,
+		CLEAR_COLOR,
+		CLEAR_DEPTH,
+		CLEAR,
+		DRAW_ELEMENTS,
+		DRAW_ARRAYS,
+		DRAW_ELEMENTS_BASE_VERTEX,
+		MULTI_DRAW_ELEMENTS_BASE_VERTEX,
+		DRAW_ELEMENTS_INSTANCED,
+	};
+
+	struct RecordedCall {
+		Call call;
+		// the arguments in call order, pointers and enums are stored as integers, floats as their bits
+		intptr_t args[6];
+	};
+
+	struct FrameStats {
+		int calls;
+		int draws;
+		int stateChanges;
+		ssize_t uploadedBytes;
+	};
+
+	RecordingRenderDeviceBackend(bool forwardToGL = false);
+
+	virtual void beginFrame() override;
+	// the calls are forwarded through a RenderDevice with its own shadow state, it is dropped together with the outer one
+	virtual void invalidateStateCache() override { _gl.invalidateStateCache(); }
+
+	virtual void genBuffers(GLsizei n, GLuint* buffers) override;
+	virtual void deleteBuffers(GLsizei n, const GLuint* buffers) override;
+	virtual void bindBuffer(GLenum target, GLuint buffer) override;
+	virtual void bufferData(GLenum target, GLsizeiptr size, const GLvoid* data, GLenum usage) override;
+	virtual void bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid* data) override;
+	virtual void* mapBuffer(GLenum target, GLenum access) override;
+	virtual void unmapBuffer(GLenum target) override;
+
+	virtual void enableVertexAttribs(uint32_t flags) override;
+	virtual void vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const GLvoid* pointer) override;
+	virtual void enableVertexAttribArray(GLuint index) override;
+	virtual void disableVertexAttribArray(GLuint index) override;
+	virtual void vertexAttribDivisor(GLuint index, GLuint divisor) override;
+	virtual void bindTexture2DN(GLuint textureUnit, GLuint textureId) override;
+	virtual void blendFunc(GLenum src, GLenum dst) override;
+	virtual void applyProgram(GLProgramState* programState, const Mat4& modelView) override;
+	virtual void uniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value) override;
+
+	virtual void enable(GLenum cap) override;
+	virtual void disable(GLenum cap) override;
+	virtual void depthMask(GLboolean flag) override;
+	virtual void depthFunc(GLenum func) override;
+	virtual bool isEnabled(GLenum cap) override;
+	virtual void getBooleanv(GLenum pname, GLboolean* data) override;
+
+	virtual void clearColor(GLclampf r, GLclampf g, GLclampf b, GLclampf a) override;
+	virtual void clearDepth(GLclampf depth) override;
+	virtual void clear(GLbitfield mask) override;
+
+	virtual void drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices) override;
+	virtual void drawArrays(GLenum mode, GLint first, GLsizei count) override;
+	virtual void drawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLint baseVertex) override;
+	virtual void multiDrawElementsBaseVertex(GLenum mode, const GLsizei* count, GLenum type, const GLvoid* const* indices, GLsizei drawCount, const GLint* baseVertex) override;
+	virtual void drawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLsizei instanceCount) override;
+
+	// the calls of the current frame, cleared by beginFrame
+	inline const std::vector<RecordedCall>& getCalls() const { return _calls; }
+	inline const FrameStats& getFrameStats() const { return _stats; }
+	// the calls of the current frame as text, one call per line
+	std::string dump() const;
+
+	static const char* getCallName(Call call);
+
+protected:
+	void record(Call call, intptr_t a0 = 0, intptr_t a1 = 0, intptr_t a2 = 0, intptr_t a3 = 0, intptr_t a4 = 0, intptr_t a5 = 0);
+
+	bool _forwardToGL;
+	RenderDevice _gl;
+	NullRenderDeviceBackend _null;
+
+	std::vector<RecordedCall> _calls;
+	FrameStats _stats;
+	// bufferData size of the last buffer mapped, counted as uploaded on unmap
+	GLsizeiptr _mappedSize;
+};
+
+NS_CC_END
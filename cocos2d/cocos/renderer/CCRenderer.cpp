@@ -25,6 +25,7 @@
 #include "renderer/CCRenderer.h"
 
 #include <algorithm>
+#include <chrono>
 
 #include "renderer/CCTrianglesCommand.h"
 #include "renderer/CCQuadCommand.h"
@@ -34,6 +35,7 @@
 #include "renderer/CCGroupCommand.h"
 #include "renderer/CCPrimitiveCommand.h"
 #include "renderer/CCMeshCommand.h"
+#include "renderer/CCFrameCapture.h"
 #include "renderer/CCGLProgramCache.h"
 #include "renderer/CCMaterial.h"
 #include "renderer/CCTechnique.h"
@@ -62,6 +64,24 @@ static bool compare3DCommand(RenderCommand* a, RenderCommand* b)
 	return  a->getDepth() > b->getDepth();
 }
 
+// by material for batching, then front to back to reduce overdraw
+static bool compareOpaque2DCommand(RenderCommand* a, RenderCommand* b)
+{
+	ArbitraryVertexCommand* avcA = static_cast<ArbitraryVertexCommand*>(a);
+	ArbitraryVertexCommand* avcB = static_cast<ArbitraryVertexCommand*>(b);
+	uint32_t materialA = avcA->getMaterial()->getMaterialId();
+	uint32_t materialB = avcB->getMaterial()->getMaterialId();
+	if (materialA != materialB) {
+		return materialA < materialB;
+	}
+	return avcA->getDepth2D() > avcB->getDepth2D();
+}
+
+static bool compareDepth2DCommand(ArbitraryVertexCommand* a, ArbitraryVertexCommand* b)
+{
+	return a->getGlobalOrder() < b->getGlobalOrder();
+}
+
 // QueueCommand
 
 class QueueCommand : public RenderCommand {
@@ -75,12 +95,26 @@ public:
 	void (Renderer::*func)();
 };
 
+// saves or restores the render state of a queue around its commands. unlike custom commands these
+// only go through the render device, so the device state cache stays valid
+class QueueStateCommand : public RenderCommand {
+public:
+	static const int QUEUE_STATE_COMMAND = 0xFE;
+
+	QueueStateCommand() : queue(nullptr), save(false) {
+		_type = (RenderCommand::Type)(QUEUE_STATE_COMMAND);
+	}
+
+	RenderQueue* queue;
+	bool save;
+};
+
 // new delegates
 static CustomCommand* newCustomCommand() {
 	return new CustomCommand();
 }
-static ArbitraryVertexCommand* newArbitraryVertexCommand() {
-	return new ArbitraryVertexCommand();
+static QueueStateCommand* newQueueStateCommand() {
+	return new QueueStateCommand();
 }
 
 // queue
@@ -120,6 +154,11 @@ void RenderQueue::push_back(RenderCommand* command)
 	}
 }
 
+void RenderQueue::pushBackOpaque2D(RenderCommand* command)
+{
+	_commands[QUEUE_GROUP::OPAQUE_2D].push_back(command);
+}
+
 ssize_t RenderQueue::size() const
 {
 	ssize_t result(0);
@@ -137,6 +176,7 @@ void RenderQueue::sort()
 	std::sort(std::begin(_commands[QUEUE_GROUP::TRANSPARENT_3D]), std::end(_commands[QUEUE_GROUP::TRANSPARENT_3D]), compare3DCommand);
 	std::sort(std::begin(_commands[QUEUE_GROUP::GLOBALZ_NEG]), std::end(_commands[QUEUE_GROUP::GLOBALZ_NEG]), compareRenderCommand);
 	std::sort(std::begin(_commands[QUEUE_GROUP::GLOBALZ_POS]), std::end(_commands[QUEUE_GROUP::GLOBALZ_POS]), compareRenderCommand);
+	std::stable_sort(std::begin(_commands[QUEUE_GROUP::OPAQUE_2D]), std::end(_commands[QUEUE_GROUP::OPAQUE_2D]), compareOpaque2DCommand);
 }
 
 RenderCommand* RenderQueue::operator[](ssize_t index) const
@@ -174,41 +214,41 @@ void RenderQueue::realloc(size_t reserveSize)
 	}
 }
 
-void RenderQueue::saveRenderState()
+void RenderQueue::saveRenderState(RenderDevice* device)
 {
-	_isDepthEnabled = glIsEnabled(GL_DEPTH_TEST) != GL_FALSE;
-	_isCullEnabled = glIsEnabled(GL_CULL_FACE) != GL_FALSE;
-	glGetBooleanv(GL_DEPTH_WRITEMASK, &_isDepthWrite);
+	_isDepthEnabled = device->isEnabled(GL_DEPTH_TEST);
+	_isCullEnabled = device->isEnabled(GL_CULL_FACE);
+	device->getBooleanv(GL_DEPTH_WRITEMASK, &_isDepthWrite);
 
 	CHECK_GL_ERROR_DEBUG();
 }
 
-void RenderQueue::restoreRenderState()
+void RenderQueue::restoreRenderState(RenderDevice* device)
 {
 	if (_isCullEnabled)
 	{
-		glEnable(GL_CULL_FACE);
+		device->enable(GL_CULL_FACE);
 		RenderState::StateBlock::_defaultState->setCullFace(true);
 	}
 	else
 	{
-		glDisable(GL_CULL_FACE);
+		device->disable(GL_CULL_FACE);
 		RenderState::StateBlock::_defaultState->setCullFace(false);
 	}
 
 
 	if (_isDepthEnabled)
 	{
-		glEnable(GL_DEPTH_TEST);
+		device->enable(GL_DEPTH_TEST);
 		RenderState::StateBlock::_defaultState->setDepthTest(true);
 	}
 	else
 	{
-		glDisable(GL_DEPTH_TEST);
+		device->disable(GL_DEPTH_TEST);
 		RenderState::StateBlock::_defaultState->setDepthTest(false);
 	}
 
-	glDepthMask(_isDepthWrite);
+	device->depthMask(_isDepthWrite);
 	RenderState::StateBlock::_defaultState->setDepthWrite(_isDepthEnabled);
 
 	CHECK_GL_ERROR_DEBUG();
@@ -224,17 +264,50 @@ static const int DEFAULT_RENDER_QUEUE = 0;
 //
 Renderer::Renderer()
 	: _lastBatchedMeshCommand(nullptr)
+	, _useBaseVertex(false)
+	, _isMeshInstancingEnabled(false)
+	, _meshInstancingSupported(false)
+	, _useMeshInstanceColors(false)
+	, _meshInstanceVBO(0)
 	, _filledVertex(0)
 	, _filledIndex(0)
 	, _glViewAssigned(false)
+	, _isHeadless(false)
 	, _isRendering(false)
 	, _isDepthTestFor2D(false)
+	, _isOpaque2DEnabled(false)
+	, _opaque2DNearZ(-100)
+	, _opaque2DFarZ(100)
+	, _isOcclusionCullingEnabled(false)
+	, _isGroupMergingEnabled(true)
+	, _isIn2DState(false)
+	, _mergedGroups(0)
+	, _isDrawingBatches(false)
+	, _occludedCommands(0)
+	, _occludedVertices(0)
+	, _drawnBatches(0)
+	, _drawnVertices(0)
+	, _uploadedBytes(0)
+	, _gatheredVertexBytes(0)
+	, _compactVertexBytesSaved(0)
+	, _skippedUploadBytes(0)
+	, _uploadCalls(0)
+	, _usedVboSlices(0)
+	, _useDirtyRangeUploads(false)
 #if CC_ENABLE_CACHE_TEXTURE_DATA
 	, _cacheTextureListener(nullptr)
 #endif
 {
 	_groupCommandManager = new (std::nothrow) GroupCommandManager();
 
+	_device = new RenderDevice();
+	_nullBackend = nullptr;
+
+	_profiler = new RendererProfiler();
+	_batchBreakStats = new BatchBreakStats();
+	_memoryStats = new RendererMemoryStats();
+	_occlusionCuller = new OcclusionCuller();
+
 	_commandGroupStack.push(DEFAULT_RENDER_QUEUE);
 
 	RenderQueue defaultRenderQueue;
@@ -249,16 +322,23 @@ Renderer::Renderer()
 	_isBufferSlicing = true;
 #endif
 
-	_renderCommands = new FastVector<RenderCommand*>();
-	_vertexBatches = new FastVector<VertexBatch>();
+	_drawPackets = new FastVector<DrawPacket>();
+	_vertexBatches = new VertexBatchList();
 
-	// init all pools
-	_avcPool1 = new FastPool<ArbitraryVertexCommand*>(&newArbitraryVertexCommand);
-	_avcPool2 = new FastPool<ArbitraryVertexCommand*>(&newArbitraryVertexCommand);
+	_subDrawCounts = new FastVector<GLsizei>();
+	_subDrawBaseVertices = new FastVector<GLint>();
+	_subDrawFirstIndices = new FastVector<ssize_t>();
+	_subDrawIndexOffsets = new FastVector<GLvoid*>();
+
+	_paletteMatrices = new FastVector<Mat4>();
 
+	// init all pools
 	_customCommandPool1 = new FastPool<CustomCommand*>(&newCustomCommand);
 	_customCommandPool2 = new FastPool<CustomCommand*>(&newCustomCommand);
 
+	_queueStateCommandPool1 = new FastPool<QueueStateCommand*>(&newQueueStateCommand);
+	_queueStateCommandPool2 = new FastPool<QueueStateCommand*>(&newQueueStateCommand);
+
 	// init queueCommands
 	_beginQueue2dCommand = new QueueCommand();
 	_beginQueue2dCommand->func = &Renderer::beginQueue2d;
@@ -274,20 +354,35 @@ Renderer::Renderer()
 	// create vertex layouts
 
 	// init all vbo related stuff
-	// TODO read the following values from a file
-	_vboByteSlice = 100000;
-	_vboCountMultiplier = 1.3f;
+	// the values come from the buffer tuner, which can load them from a config file before the gl view is assigned
+	_bufferTuner = new RendererBufferTuner();
+	_bufferTuner->clearChanged();
+	_vboByteSlice = _bufferTuner->getSliceSize();
+	_vboCountMultiplier = _bufferTuner->getConfig().vboCountMultiplier;
+	_largestCommandVertexBytes = 0;
+	_uploadNs = 0;
+
+	// the staging buffers start at the capacities of the memory budget, the full size unless a budget is enabled
+	_memoryBudget = new RendererMemoryBudget();
+	_memoryBudget->clearChanged();
+	_arbitraryVertexCapacity = _memoryBudget->getVertexCapacity();
+	_arbitraryIndexCapacity = _memoryBudget->getIndexCapacity();
+	_arbitraryVertexBuffer = (byte*)malloc(_arbitraryVertexCapacity);
+	_arbitraryIndexBuffer = (unsigned short*)malloc(_arbitraryIndexCapacity * sizeof(unsigned short));
+	_quadIndices = new GLushort[INDEX_VBO_SIZE];
 
 	// this data is renderer computed
 
 	if (_isBufferSlicing) {
-		_vboCount = (int)ceilf(ARBITRARY_VBO_SIZE / (float)_vboByteSlice);
+		_vboCount = _bufferTuner->getVboCount();
 	}
 	else {
 		_vboCount = 10;
 	}
 
 	_aBufferVBOs = new VertexIndexBO[_vboCount];
+	_vboDirtyTrackers = new BufferDirtyTracker[_vboCount * 2];
+	_vboBufferBytes = new ssize_t[_vboCount * 2]();
 }
 
 Renderer::~Renderer()
@@ -295,23 +390,54 @@ Renderer::~Renderer()
 	_renderGroups.clear();
 	_groupCommandManager->release();
 
-	delete _renderCommands;
+	delete _drawPackets;
 	delete _vertexBatches;
 
-	// delete all pools
-	delete _avcPool1;
-	delete _avcPool2;
+	delete _subDrawCounts;
+	delete _subDrawBaseVertices;
+	delete _subDrawFirstIndices;
+	delete _subDrawIndexOffsets;
+
+	delete _paletteMatrices;
 
+	// delete all pools
 	delete _customCommandPool1;
 	delete _customCommandPool2;
 
+	delete _queueStateCommandPool1;
+	delete _queueStateCommandPool2;
+
 	delete[] _triangleCommandVAIL.infos;
 
-	for (unsigned int i = 0; i < _vboCount; i++) {
-		glDeleteBuffers(2, &_aBufferVBOs[i].buffers[0]);
+	if (_glViewAssigned) {
+		for (unsigned int i = 0; i < _vboCount; i++) {
+			_device->deleteBuffers(2, &_aBufferVBOs[i].buffers[0]);
+		}
+		if (_meshInstanceVBO != 0) {
+			_device->deleteBuffers(1, &_meshInstanceVBO);
+		}
+	}
+
+	for (auto& entry : _instancedPrograms) {
+		entry.second->release();
 	}
 
+	delete _device;
+	delete _nullBackend;
+	delete _profiler;
+	delete _batchBreakStats;
+	delete _memoryStats;
+	delete _occlusionCuller;
+	delete _bufferTuner;
+	delete _memoryBudget;
+
 	delete[] _aBufferVBOs;
+	delete[] _vboDirtyTrackers;
+	delete[] _vboBufferBytes;
+
+	free(_arbitraryVertexBuffer);
+	free(_arbitraryIndexBuffer);
+	delete[] _quadIndices;
 
 #if CC_ENABLE_CACHE_TEXTURE_DATA
 	Director::getInstance()->getEventDispatcher()->removeEventListener(_cacheTextureListener);
@@ -329,6 +455,50 @@ void Renderer::initGLView()
 	Director::getInstance()->getEventDispatcher()->addEventListenerWithFixedPriority(_cacheTextureListener, -1);
 #endif
 
+	setupQuadIndices();
+
+	setupBuffer();
+
+#if (CC_TARGET_PLATFORM == CC_PLATFORM_WIN32 || CC_TARGET_PLATFORM != CC_PLATFORM_WIN32 || CC_TARGET_PLATFORM != CC_PLATFORM_WIN32)
+	// only use glMapBuffer on desktop platforms as it is used with buffer orphaning, and buffer orphaning could be slow with really big data on mobile devices
+	_useMapBuffer = Configuration::getInstance()->checkForGLExtension("map_buffer");
+	_useMapBuffer = false;
+#endif
+
+#if CC_RENDERER_BASE_VERTEX
+	_useBaseVertex = Configuration::getInstance()->checkForGLExtension("draw_elements_base_vertex");
+#endif
+
+#if CC_RENDERER_INSTANCING
+	_meshInstancingSupported = Configuration::getInstance()->checkForGLExtension("instanced_arrays");
+#endif
+
+	_glViewAssigned = true;
+}
+
+void Renderer::initHeadless(RenderDeviceBackend* backend)
+{
+	CCASSERT(!_glViewAssigned, "The renderer was already initialized");
+
+	if (backend == nullptr) {
+		_nullBackend = new NullRenderDeviceBackend();
+		backend = _nullBackend;
+	}
+	_device->setBackend(backend);
+
+	setupQuadIndices();
+
+	setupBuffer();
+
+	_useMapBuffer = false;
+	_useBaseVertex = false;
+
+	_isHeadless = true;
+	_glViewAssigned = true;
+}
+
+void Renderer::setupQuadIndices()
+{
 	//setup index data for quads
 
 	for (int i = 0; i < VBO_SIZE / 4; i++)
@@ -342,21 +512,144 @@ void Renderer::initGLView()
 	}
 
 	QuadCommand::setStaticIndices(_quadIndices);
+}
 
-	setupBuffer();
+void Renderer::setupBuffer()
+{
+	// pick up a config loaded before the buffers are created
+	if (_bufferTuner->hasChanged()) {
+		resizeVBOs();
+	}
+	if (_memoryBudget->hasChanged()) {
+		resizeArbitraryBuffers();
+	}
+	setupVBO();
+}
 
-#if (CC_TARGET_PLATFORM == CC_PLATFORM_WIN32 || CC_TARGET_PLATFORM != CC_PLATFORM_WIN32 || CC_TARGET_PLATFORM != CC_PLATFORM_WIN32)
-	// only use glMapBuffer on desktop platforms as it is used with buffer orphaning, and buffer orphaning could be slow with really big data on mobile devices
-	_useMapBuffer = Configuration::getInstance()->checkForGLExtension("map_buffer");
-	_useMapBuffer = false;
-#endif
+void Renderer::resizeVBOs()
+{
+	_bufferTuner->clearChanged();
+	_vboByteSlice = _bufferTuner->getSliceSize();
+	_vboCountMultiplier = _bufferTuner->getConfig().vboCountMultiplier;
+
+	if (_isBufferSlicing && _bufferTuner->getVboCount() != _vboCount) {
+		delete[] _aBufferVBOs;
+		delete[] _vboDirtyTrackers;
+		delete[] _vboBufferBytes;
+		_vboCount = _bufferTuner->getVboCount();
+		_aBufferVBOs = new VertexIndexBO[_vboCount];
+		_vboDirtyTrackers = new BufferDirtyTracker[_vboCount * 2];
+		_vboBufferBytes = new ssize_t[_vboCount * 2]();
+		_vboIndex = 0;
+	}
+}
 
-	_glViewAssigned = true;
+void Renderer::tuneBuffers()
+{
+	if (!_isBufferSlicing) {
+		return;
+	}
+
+	_bufferTuner->addFrame(_currentVertexBufferOffset, _largestCommandVertexBytes, _batchBreakStats->getCount(BATCH_BREAK_VBO_SLICE), _uploadNs);
+	if (!_bufferTuner->hasChanged()) {
+		return;
+	}
+
+	// only called between frames, so no batch references the buffers anymore
+	bool reallocate = _bufferTuner->getVboCount() != _vboCount;
+	if (reallocate) {
+		for (unsigned int i = 0; i < _vboCount; i++) {
+			_device->deleteBuffers(2, &_aBufferVBOs[i].buffers[0]);
+		}
+	}
+	resizeVBOs();
+	if (reallocate) {
+		setupVBO();
+	}
 }
 
-void Renderer::setupBuffer()
+bool Renderer::reserveArbitraryBuffers(ssize_t vertexBytes, ssize_t indexCount)
 {
-	setupVBO();
+	bool fits = _memoryBudget->grow(vertexBytes, indexCount);
+	resizeArbitraryBuffers();
+	return fits;
+}
+
+void Renderer::resizeArbitraryBuffers()
+{
+	_memoryBudget->clearChanged();
+
+	// realloc keeps what was gathered so far, only the write pointers have to follow
+	ssize_t vertexCapacity = _memoryBudget->getVertexCapacity();
+	if (vertexCapacity != _arbitraryVertexCapacity) {
+		_arbitraryVertexBuffer = (byte*)realloc(_arbitraryVertexBuffer, vertexCapacity);
+		_arbitraryVertexCapacity = vertexCapacity;
+	}
+	ssize_t indexCapacity = _memoryBudget->getIndexCapacity();
+	if (indexCapacity != _arbitraryIndexCapacity) {
+		_arbitraryIndexBuffer = (unsigned short*)realloc(_arbitraryIndexBuffer, indexCapacity * sizeof(unsigned short));
+		_arbitraryIndexCapacity = indexCapacity;
+	}
+	_currentVertexBuffer = _arbitraryVertexBuffer + _currentVertexBufferOffset;
+	_currentIndexBuffer = _arbitraryIndexBuffer + _currentIndexBufferOffset;
+}
+
+void Renderer::budgetBuffers()
+{
+	_memoryBudget->addFrame(_currentVertexBufferOffset, _currentIndexBufferOffset);
+	if (!_memoryBudget->hasChanged()) {
+		return;
+	}
+
+	resizeArbitraryBuffers();
+
+	// release gl storage bigger than the budget, the next upload into the vbo specifies it again
+	for (unsigned int i = 0; i < _vboCount * 2; i++) {
+		bool isIndexBuffer = (i & 1) != 0;
+		ssize_t capacity = isIndexBuffer ? _arbitraryIndexCapacity * (ssize_t)sizeof(GLushort) : _arbitraryVertexCapacity;
+		if (_vboBufferBytes[i] <= capacity) {
+			continue;
+		}
+		GLenum target = isIndexBuffer ? GL_ELEMENT_ARRAY_BUFFER : GL_ARRAY_BUFFER;
+		_device->bindBuffer(target, _aBufferVBOs[i / 2].buffers[i & 1]);
+		_device->bufferData(target, 0, nullptr, GL_STREAM_DRAW);
+		_device->bindBuffer(target, 0);
+		_vboBufferBytes[i] = 0;
+		_vboDirtyTrackers[i].invalidate();
+	}
+}
+
+void Renderer::recordMemoryStats(ssize_t uploadedBytes, ssize_t uploadCalls)
+{
+	RendererMemoryFrame frame;
+	long long* values = frame.values;
+	values[RENDERER_MEMORY_GATHERED_VERTEX_BYTES] = _currentVertexBufferOffset;
+	values[RENDERER_MEMORY_GATHERED_INDEX_BYTES] = _currentIndexBufferOffset * sizeof(unsigned short);
+	values[RENDERER_MEMORY_UPLOADED_BYTES] = uploadedBytes;
+	values[RENDERER_MEMORY_UPLOAD_CALLS] = uploadCalls;
+	values[RENDERER_MEMORY_VBO_SLICES] = _usedVboSlices;
+	values[RENDERER_MEMORY_VBO_COUNT] = _vboCount;
+	values[RENDERER_MEMORY_VERTEX_BUFFER_OCCUPANCY] = _currentVertexBufferOffset * 100 / _arbitraryVertexCapacity;
+	values[RENDERER_MEMORY_INDEX_BUFFER_OCCUPANCY] = _currentIndexBufferOffset * 100 / _arbitraryIndexCapacity;
+	// a frame takes its commands from the first pool and only returns them into the second, so what it took is its peak
+	values[RENDERER_MEMORY_CUSTOM_COMMAND_POOL_PEAK] = _customCommandPool1->getTakenCount();
+	values[RENDERER_MEMORY_QUEUE_STATE_POOL_PEAK] = _queueStateCommandPool1->getTakenCount();
+	values[RENDERER_MEMORY_VERTEX_BATCHES] = _vertexBatches->size();
+	_memoryStats->addFrame(frame);
+}
+
+ssize_t Renderer::getStagingBufferBytes() const
+{
+	return _arbitraryVertexCapacity + _arbitraryIndexCapacity * sizeof(unsigned short) + INDEX_VBO_SIZE * sizeof(GLushort);
+}
+
+ssize_t Renderer::getGpuBufferBytes() const
+{
+	ssize_t bytes = 0;
+	for (unsigned int i = 0; i < _vboCount * 2; i++) {
+		bytes += _vboBufferBytes[i];
+	}
+	return bytes;
 }
 
 void Renderer::setupVBOAndVAO()
@@ -365,16 +658,25 @@ void Renderer::setupVBOAndVAO()
 
 void Renderer::setupVBO()
 {
+	// with a memory budget the storage is left to the first upload, which sizes it to what the frame needs
+	bool specifyStorage = !_memoryBudget->isEnabled();
 	int vboSize = ARBITRARY_VBO_SIZE / _vboCount;
 	int iboSize = ARBITRARY_INDEX_VBO_SIZE / _vboCount;
 	for (unsigned int i = 0; i < _vboCount; i++) {
 		GLuint* buffers = &_aBufferVBOs[i].buffers[0];
-		glGenBuffers(2, buffers);
+		_device->genBuffers(2, buffers);
+
+		if (specifyStorage) {
+			_device->bindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+			_device->bufferData(GL_ARRAY_BUFFER, vboSize, nullptr, GL_STREAM_DRAW);
+			_device->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[1]);
+			_device->bufferData(GL_ELEMENT_ARRAY_BUFFER, iboSize, nullptr, GL_STREAM_DRAW);
+		}
+		_vboBufferBytes[i * 2] = specifyStorage ? vboSize : 0;
+		_vboBufferBytes[i * 2 + 1] = specifyStorage ? iboSize : 0;
 
-		glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
-		glBufferData(GL_ARRAY_BUFFER, vboSize, _arbitraryVertexBuffer, GL_STREAM_DRAW);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[1]);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, iboSize, _arbitraryIndexBuffer, GL_STREAM_DRAW);
+		_vboDirtyTrackers[i * 2].invalidate();
+		_vboDirtyTrackers[i * 2 + 1].invalidate();
 	}
 
 	CHECK_GL_ERROR_DEBUG();
@@ -396,6 +698,17 @@ void Renderer::addCommand(RenderCommand* command, int renderQueue)
 	CCASSERT(renderQueue >= 0, "Invalid render queue");
 	CCASSERT(command->getType() != RenderCommand::Type::UNKNOWN_COMMAND, "Invalid Command Type");
 
+	if (_isOpaque2DEnabled && _isDepthTestFor2D && command->getType() == RenderCommand::Type::ARBITRARY_VERTEX_COMMAND) {
+		ArbitraryVertexCommand* avc = static_cast<ArbitraryVertexCommand*>(command);
+		if (avc->_transformOnCpu && !avc->is3D()) {
+			_depth2DCommands.push_back(avc);
+		}
+		if (avc->_transformOnCpu && avc->isOpaque2D()) {
+			_renderGroups[renderQueue].pushBackOpaque2D(command);
+			return;
+		}
+	}
+
 	_renderGroups[renderQueue].push_back(command);
 }
 
@@ -419,15 +732,12 @@ int Renderer::createRenderQueue()
 }
 
 void Renderer::nextVertexBatch() {
-	if (_vertexBatches->at(_currentVertexBatchIndex).endRCIndex == 0) {
+	if (_vertexBatches->drawPacket(_currentVertexBatchIndex) < 0) {
 		// vertex batch not used yet -> return
 		return;
 	}
-	_vertexBatches->push_back_resize(VertexBatch());
-	_previousVertexBatch = _vertexBatches->pointerAt(_currentVertexBatchIndex);
-	_currentVertexBatchIndex++;
-	_currentVertexBatch = _vertexBatches->pointerAt(_currentVertexBatchIndex);
-	_currentVertexBatch->endRCIndex = 0;
+	_previousVertexBatchIndex = _currentVertexBatchIndex;
+	_currentVertexBatchIndex = _vertexBatches->push_back();
 }
 
 inline bool matrixEqual(Mat4* mat1, Mat4* mat2) {
@@ -442,10 +752,130 @@ inline bool matrixEqual(Mat4* mat1, Mat4* mat2) {
 	return true;
 }
 
+void Renderer::convertToListIndices(MaterialPrimitiveType type, const GLushort* src, ssize_t count)
+{
+	// non indexed data is converted as if it had the indices 0..count-1
+	auto index = [src](ssize_t i) { return src ? src[i] : (GLushort)i; };
+
+	_listIndices.clear();
+	switch (type) {
+	case MaterialPrimitiveType::TRIANGLE_STRIP:
+		// every second triangle is flipped to keep the winding
+		for (ssize_t i = 0; i + 2 < count; i++) {
+			if (i & 1) {
+				_listIndices.insert(_listIndices.end(), { index(i + 1), index(i), index(i + 2) });
+			}
+			else {
+				_listIndices.insert(_listIndices.end(), { index(i), index(i + 1), index(i + 2) });
+			}
+		}
+		break;
+	case MaterialPrimitiveType::TRIANGLE_FAN:
+		for (ssize_t i = 1; i + 1 < count; i++) {
+			_listIndices.insert(_listIndices.end(), { index(0), index(i), index(i + 1) });
+		}
+		break;
+	case MaterialPrimitiveType::LINE_STRIP:
+	case MaterialPrimitiveType::LINE_LOOP:
+		for (ssize_t i = 0; i + 1 < count; i++) {
+			_listIndices.insert(_listIndices.end(), { index(i), index(i + 1) });
+		}
+		if (type == MaterialPrimitiveType::LINE_LOOP && count > 2) {
+			_listIndices.insert(_listIndices.end(), { index(count - 1), index(0) });
+		}
+		break;
+	default:
+		CCASSERT(false, "Not a strip, fan or loop");
+		break;
+	}
+}
+
+void Renderer::indexCurrentBatch(GLuint vertexStride)
+{
+	const VertexBatchBufferRange& vertexRange = _vertexBatches->vertexRange(_currentVertexBatchIndex);
+	ssize_t firstVertex = (vertexRange.usageStart - vertexRange.offset) / vertexStride;
+	ssize_t count = _filledVertex - firstVertex;
+	if (count <= 0) {
+		return;
+	}
+	// the gather reserved room for these indices before it started the command
+
+	if (_useBaseVertex) {
+		// the indices start at 0 and the offset is applied by the sub draw. without the 0xFFFF limit the batch can hold
+		// more vertices than a short addresses, so they are split into sub draws of at most 0x10000 vertices
+		ssize_t firstIndex = _currentIndexBufferOffset - _vertexBatches->indexRange(_currentVertexBatchIndex).usageStart;
+		for (ssize_t done = 0; done < count; ) {
+			ssize_t subCount = std::min(count - done, (ssize_t)0x10000);
+			for (ssize_t i = 0; i < subCount; i++) {
+				_currentIndexBuffer[done + i] = (GLushort)i;
+			}
+			_subDrawCounts->push_back_resize((GLsizei)subCount);
+			_subDrawBaseVertices->push_back_resize((GLint)(firstVertex + done));
+			_subDrawFirstIndices->push_back_resize(firstIndex + done);
+			done += subCount;
+		}
+		_vertexBatches->subDraws(_currentVertexBatchIndex).end = (int)_subDrawCounts->size();
+	}
+	else {
+		for (ssize_t i = 0; i < count; i++) {
+			_currentIndexBuffer[i] = (GLushort)(firstVertex + i);
+		}
+	}
+
+	_currentIndexBuffer += count;
+	_currentIndexBufferOffset += count;
+}
+
+void Renderer::assignDepth2D()
+{
+	// the ordered path draws by global order and keeps the submission order within one, so the stable sort gives the draw order.
+	// every command gets its own z inside the range, which raw global orders wouldnt guarantee
+	std::stable_sort(_depth2DCommands.begin(), _depth2DCommands.end(), compareDepth2DCommand);
+	float step = (_opaque2DFarZ - _opaque2DNearZ) / (_depth2DCommands.size() + 1);
+	for (size_t i = 0; i < _depth2DCommands.size(); i++) {
+		_depth2DCommands[i]->_orderDepth2D = _opaque2DNearZ + step * (i + 1);
+	}
+}
+
+void Renderer::cullOccludedCommands(RenderQueue& queue)
+{
+	Director* director = Director::getInstance();
+	_occlusionCuller->begin(Rect(director->getVisibleOrigin(), director->getVisibleSize()));
+
+	// front to back: the group drawn last first, each group from its last command.
+	// the 3d groups are left alone, 2d drawn after them still hides the negative group
+	static const RenderQueue::QUEUE_GROUP groups[] = { RenderQueue::GLOBALZ_POS, RenderQueue::GLOBALZ_ZERO, RenderQueue::GLOBALZ_NEG };
+	for (auto group : groups) {
+		std::vector<RenderCommand*>& commands = queue.getSubQueue(group);
+		bool culled = false;
+		for (auto i = commands.rbegin(); i != commands.rend(); i++) {
+			if ((*i)->getType() != RenderCommand::Type::ARBITRARY_VERTEX_COMMAND) {
+				continue;
+			}
+			ArbitraryVertexCommand* avc = (ArbitraryVertexCommand*)(*i);
+			if (avc->_hasOcclusionBounds && !avc->is3D() &&
+				_occlusionCuller->isOccluded(OcclusionCuller::getBoundingRect(avc->_occlusionBounds, avc->_mv))) {
+				_occludedCommands++;
+				_occludedVertices += avc->_data.vertexCount;
+				*i = nullptr;
+				culled = true;
+				continue;
+			}
+			// only an axis aligned opaque rect stays a rect on screen
+			if (avc->_hasOpaqueRect && avc->isOpaque2D() && avc->_mv.m[1] == 0 && avc->_mv.m[4] == 0) {
+				_occlusionCuller->addOccluder(OcclusionCuller::getBoundingRect(avc->_opaqueRect, avc->_mv));
+			}
+		}
+		if (culled) {
+			commands.erase(std::remove(commands.begin(), commands.end(), nullptr), commands.end());
+		}
+	}
+}
+
 void Renderer::makeSingleRenderCommandList(std::vector<RenderCommand*> commands) {
 	int j = 0;
 	// dont use with push_back_resize: some weird realloc error occurs
-	//_renderCommands->reserveElements(commands.size());
+	//_drawPackets->reserveElements(commands.size());
 
 	for (auto i = commands.cbegin(); i < commands.cend(); i++, j++) {
 		auto type = (*i)->getType();
@@ -459,32 +889,77 @@ void Renderer::makeSingleRenderCommandList(std::vector<RenderCommand*> commands)
 			bool transformOnCpu = avc->_transformOnCpu;
 			ArbitraryVertexCommand::Data data = avc->_data;
 			Mat4 modelView = avc->_mv;
-			ssize_t vertexDataSize = avc->getVertexDataSize();
+			bool usePalette = !transformOnCpu && currMaterial->_paletteSize > 0;
+			bool appendPaletteMatrix = false;
+			// emitting commands write their vertices in the material format straight into the buffer
+			bool emit = avc->_emit != nullptr;
+			bool emitIndices = emit && avc->_isIndexed;
+
+			// strips, fans and loops cant be concatenated, so they are gathered as indexed lists
+			bool isIndexed = avc->_isIndexed;
+			if (currMaterial->_primitiveType != currMaterial->_batchPrimitiveType) {
+				if (isIndexed) {
+					convertToListIndices(currMaterial->_primitiveType, data.indexData, data.indexCount);
+				}
+				else {
+					convertToListIndices(currMaterial->_primitiveType, nullptr, data.vertexCount);
+				}
+				data.indexData = _listIndices.data();
+				data.indexCount = (ssize_t)_listIndices.size();
+				isIndexed = true;
+			}
+
+			// the compact format is only usable for cpu transformed V3F_C4B_T2F data, and z is needed when 2d is depth tested
+			bool compact = avc->_compactVertexFormat &&
+				!emit &&
+				transformOnCpu &&
+				!_isDepthTestFor2D &&
+				currMaterial->_vertexStreamAttributes.format == VertexStreamAttributes::getV3F_C4B_T2F()->format;
+			// interned, equal layouts of different materials are the same format
+			const VertexFormat* vertexFormat = compact ? VertexStreamAttributes::getV2F_C4B_T2US()->format :
+				usePalette ? currMaterial->_paletteVertexStreamAttributes.format : currMaterial->_vertexStreamAttributes.format;
+			ssize_t vertexDataSize = data.vertexCount * vertexFormat->stride;
+			if (vertexDataSize > _largestCommandVertexBytes) {
+				_largestCommandVertexBytes = vertexDataSize;
+			}
+
+			// room for the most the command can write, before any batch state changes: its indices, or sequential ones if it joins
+			// an indexed batch, plus the indices of the current batch if it turns it into an indexed one
+			ssize_t maxIndexCount = std::max(data.indexCount, data.vertexCount) + (isIndexed ? _filledVertex : 0);
+			if (_currentVertexBufferOffset + vertexDataSize > _arbitraryVertexCapacity ||
+				_currentIndexBufferOffset + maxIndexCount > _arbitraryIndexCapacity) {
+				if (!reserveArbitraryBuffers(_currentVertexBufferOffset + vertexDataSize, _currentIndexBufferOffset + maxIndexCount)) {
+					// writing it would overflow the staging buffers
+					CCLOG("Renderer: dropped a command, the vertex or index buffer is full");
+					continue;
+				}
+			}
 
 			_lastWasFlushCommand = false;
 
 			// process batching
 
-			// check if buffer limit is exceeded
-			if (_currentVertexBufferOffset + vertexDataSize > ARBITRARY_VBO_SIZE ||
-				_currentIndexBufferOffset + data.indexCount > ARBITRARY_INDEX_VBO_SIZE) {
-				CCASSERT(false, "Exceeding the index or vertex buffer size");
-			}
-
 			if (_firstAVC) {
-				_vertexBatches->push_back_resize(VertexBatch());
-				_currentVertexBatch->material = currMaterial;
-				_currentVertexBatch->indexed = avc->_isIndexed;
+				_currentVertexBatchIndex = _previousVertexBatchIndex = _vertexBatches->push_back();
+				_vertexBatches->material(_currentVertexBatchIndex) = currMaterial;
+				_vertexBatches->format(_currentVertexBatchIndex) = vertexFormat;
+				_vertexBatches->flags(_currentVertexBatchIndex) = isIndexed ? VERTEX_BATCH_INDEXED : 0;
 				_lastMaterial_skipBatching = currMaterial->_skipBatching && currMaterial->_id == MATERIAL_ID_DO_NOT_BATCH;
 				newCommand = true;
 				_firstAVC = false;
 			}
 			else {
 
-				bool needsFilledVertexReset = _filledVertex + data.vertexCount > 0xFFFF; // meaning no index(short) could adress it anymore
+				// meaning no index(short) could adress it anymore. with base vertex only the commands own indices have to fit into a short,
+				// so a non indexed command too big for them cant join an indexed batch, it would get sequential indices
+				bool indexLimitReached = _useBaseVertex ?
+					!isIndexed && data.vertexCount > 0x10000 && (_vertexBatches->flags(_currentVertexBatchIndex) & VERTEX_BATCH_INDEXED) :
+					_filledVertex + data.vertexCount > 0xFFFF;
+				bool needsFilledVertexReset = indexLimitReached;
+				bool vboFull = false;
 
 				if (_isBufferSlicing) {
-					bool vboFull = ((_currentVertexBufferOffset + vertexDataSize) - _lastVertexBufferSlicePos) > _vboByteSlice;
+					vboFull = ((_currentVertexBufferOffset + vertexDataSize) - _lastVertexBufferSlicePos) > _vboByteSlice;
 					needsFilledVertexReset |= vboFull;
 
 					if (vboFull) {
@@ -494,16 +969,18 @@ void Renderer::makeSingleRenderCommandList(std::vector<RenderCommand*> commands)
 				}
 
 				bool currMaterial_skipBatching = currMaterial->_skipBatching || currMaterial->_id == MATERIAL_ID_DO_NOT_BATCH;
+				// the id is a hash, on a match the state is compared with the material the batch started with
+				bool materialDiffers = currMaterial->_id != _currentMaterial2dId || !currMaterial->hasSameState(_vertexBatches->material(_currentVertexBatchIndex));
 				bool needFlushDueToDifferentMatrix = false;
 
-				bool indexedStateDiffers = avc->_isIndexed != _lastCommandWasIndexed;
-
-				needsFilledVertexReset |= indexedStateDiffers;
+				// the formats are interned, equal layouts are the same format
+				bool vertexFormatDiffers = vertexFormat != _currentVertexFormat;
 
 				// check if there need to be new batch due to different transform mode:
 				// last command was cpu-transform and new one isnt -> new batch
 				// last command was non-cpu-transform and new one is -> new batch
-				// last command and new command are cpu-transformed, but dont share the same modelview -> new batch
+				// last command and new command are cpu-transformed, but dont share the same modelview -> new batch, unless the
+				// material has a matrix palette with room left, then the command only adds its matrix to the palette of the batch
 				if (_lastAVC_was_NCT) {
 					do {
 						if (transformOnCpu) {
@@ -511,7 +988,13 @@ void Renderer::makeSingleRenderCommandList(std::vector<RenderCommand*> commands)
 							break;
 						}
 						if (!matrixEqual(&_lastAVC_NCT_Matrix, &modelView)) {
-							needFlushDueToDifferentMatrix = true;
+							const VertexBatchPaletteRange& palette = _vertexBatches->palette(_currentVertexBatchIndex);
+							if (usePalette && !materialDiffers && palette.end - palette.start < currMaterial->_paletteSize) {
+								appendPaletteMatrix = true;
+							}
+							else {
+								needFlushDueToDifferentMatrix = true;
+							}
 							_lastAVC_NCT_Matrix = modelView;
 						}
 					} while (0);
@@ -526,59 +1009,163 @@ void Renderer::makeSingleRenderCommandList(std::vector<RenderCommand*> commands)
 				// either curr or prev materials skipped batching?
 				// there needs to be a _filledVertex reset
 				// the above check returned new batch
-				if (currMaterial->_id != _currentMaterial2dId ||
+				if (materialDiffers ||
 					currMaterial_skipBatching ||
 					_lastMaterial_skipBatching ||
 					needsFilledVertexReset ||
-					needFlushDueToDifferentMatrix)
+					needFlushDueToDifferentMatrix ||
+					vertexFormatDiffers)
 				{
-					// set the previous vertex batch end render command index
-					_currentVertexBatch->endRCIndex = _currentAVCommandCount;
+					unsigned int reasons =
+						materialDiffers << BATCH_BREAK_MATERIAL |
+						(currMaterial_skipBatching || _lastMaterial_skipBatching) << BATCH_BREAK_SKIP_BATCHING |
+						indexLimitReached << BATCH_BREAK_INDEX_LIMIT |
+						vboFull << BATCH_BREAK_VBO_SLICE |
+						needFlushDueToDifferentMatrix << BATCH_BREAK_MATRIX |
+						vertexFormatDiffers << BATCH_BREAK_VERTEX_FORMAT;
+					_batchBreakStats->addBreak(reasons, _currentMaterial2dId, currMaterial->_id);
+
 					// go to next vertex batch
 					nextVertexBatch();
-					// set material and starting render command index
-					_currentVertexBatch->material = currMaterial;
-					_currentVertexBatch->indexed = avc->_isIndexed;
-					_currentVertexBatch->indexBufferHandle = 0;
-					_currentVertexBatch->vertexBufferHandle = 0;
-					_currentVertexBatch->startingRCIndex = _currentAVCommandCount;
-					if (needsFilledVertexReset || _lastArbitraryCommand->_material2d->_vertexStreamAttributes.id != currMaterial->_vertexStreamAttributes.id) {
-						// if needsFilledVertexReset is set or the vertex attrib format from the previous material is different from the current use new vertex offset
+					// set material and format
+					_vertexBatches->material(_currentVertexBatchIndex) = currMaterial;
+					_vertexBatches->format(_currentVertexBatchIndex) = vertexFormat;
+					_vertexBatches->flags(_currentVertexBatchIndex) = isIndexed ? VERTEX_BATCH_INDEXED : 0;
+					_vertexBatches->buffers(_currentVertexBatchIndex).indexBufferHandle = 0;
+					_vertexBatches->buffers(_currentVertexBatchIndex).vertexBufferHandle = 0;
+
+					VertexBatchBufferRange& vertexRange = _vertexBatches->vertexRange(_currentVertexBatchIndex);
+					VertexBatchBufferRange& indexRange = _vertexBatches->indexRange(_currentVertexBatchIndex);
+					VertexBatchBufferRange& previousVertexRange = _vertexBatches->vertexRange(_previousVertexBatchIndex);
+					VertexBatchBufferRange& previousIndexRange = _vertexBatches->indexRange(_previousVertexBatchIndex);
+					if (needsFilledVertexReset || vertexFormatDiffers) {
+						// if needsFilledVertexReset is set or the vertex attrib format from the previous batch is different from the current use new vertex offset
 						_filledVertex = 0;
-						_currentVertexBatch->indexBufferOffset = _currentIndexBufferOffset;
-						_currentVertexBatch->vertexBufferOffset = _currentVertexBufferOffset;
+						indexRange.offset = _currentIndexBufferOffset;
+						vertexRange.offset = _currentVertexBufferOffset;
 					}
 					else {
 						// use the offsets from the previous one
-						_currentVertexBatch->indexBufferOffset = _previousVertexBatch->indexBufferOffset;
-						_currentVertexBatch->vertexBufferOffset = _previousVertexBatch->vertexBufferOffset;
+						indexRange.offset = previousIndexRange.offset;
+						vertexRange.offset = previousVertexRange.offset;
 					}
-					_previousVertexBatch->indexBufferUsageEnd = _currentVertexBatch->indexBufferUsageStart = _currentIndexBufferOffset;
-					_previousVertexBatch->vertexBufferUsageEnd = _currentVertexBatch->vertexBufferUsageStart = _currentVertexBufferOffset;
+					previousIndexRange.usageEnd = indexRange.usageStart = _currentIndexBufferOffset;
+					previousVertexRange.usageEnd = vertexRange.usageStart = _currentVertexBufferOffset;
+					_vertexBatches->subDraws(_currentVertexBatchIndex).start = _vertexBatches->subDraws(_currentVertexBatchIndex).end = (int)_subDrawCounts->size();
 					newCommand = true;
 				}
 			}
+
+			// indexed and non indexed commands share batches: a batch becomes indexed with its first indexed command,
+			// the non indexed commands in it get sequential indices
+			unsigned char& batchFlags = _vertexBatches->flags(_currentVertexBatchIndex);
+			if (isIndexed && !(batchFlags & VERTEX_BATCH_INDEXED)) {
+				indexCurrentBatch(vertexFormat->stride);
+				batchFlags |= VERTEX_BATCH_INDEXED;
+			}
+			else if (!isIndexed && (batchFlags & VERTEX_BATCH_INDEXED)) {
+				_listIndices.resize(data.vertexCount);
+				for (ssize_t k = 0; k < data.vertexCount; k++) {
+					_listIndices[k] = (GLushort)k;
+				}
+				data.indexData = _listIndices.data();
+				data.indexCount = data.vertexCount;
+			}
+
 			_lastAVC_was_NCT = !transformOnCpu;
-			_lastCommandWasIndexed = avc->_isIndexed;
 			_currentMaterial2dId = currMaterial->_id;
+			_currentVertexFormat = vertexFormat;
+
+			_gatheredVertexBytes += vertexDataSize;
+
+			GLubyte paletteIndex = 0;
+			if (usePalette) {
+				VertexBatchPaletteRange& palette = _vertexBatches->palette(_currentVertexBatchIndex);
+				if (palette.start == palette.end) {
+					// first command of the batch
+					palette.start = palette.end = (int)_paletteMatrices->size();
+					_paletteMatrices->push_back_resize(modelView);
+					palette.end++;
+				}
+				else if (appendPaletteMatrix) {
+					_paletteMatrices->push_back_resize(modelView);
+					palette.end++;
+				}
+				paletteIndex = (GLubyte)(palette.end - palette.start - 1);
+			}
 
 			// data copying logic
-			memcpy(_currentVertexBuffer, data.vertexData, vertexDataSize);
-			if (transformOnCpu) {
+			if (emit) {
+				// the indices are written rebased, just like the copy below does it
+				GLushort indexBase = (_filledVertex == 0 || _useBaseVertex) ? 0 : (GLushort)_filledVertex;
+				avc->_emit(_currentVertexBuffer, emitIndices ? _currentIndexBuffer : nullptr, indexBase);
+			}
+			else if (compact) {
+				// transform and pack the vertices in one pass
+				const V3F_C4B_T2F* src = reinterpret_cast<const V3F_C4B_T2F*>(data.vertexData);
+				const V3F_C4B_T2F* srcEnd = src + data.vertexCount;
+				V2F_C4B_T2US* dst = reinterpret_cast<V2F_C4B_T2US*>(_currentVertexBuffer);
+				Vec3 position;
+				while (src < srcEnd) {
+					modelView.transformPoint(src->vertices, &position);
+					dst->vertices.x = position.x;
+					dst->vertices.y = position.y;
+					dst->colors = src->colors;
+					dst->texCoords[0] = (GLushort)(src->texCoords.u * 65535.0f + 0.5f);
+					dst->texCoords[1] = (GLushort)(src->texCoords.v * 65535.0f + 0.5f);
+					src++;
+					dst++;
+				}
+				_compactVertexBytesSaved += data.vertexCount * (VertexStreamAttributes::getV3F_C4B_T2F()->stride - vertexFormat->stride);
+			}
+			else if (usePalette) {
+				// copy vertex by vertex and append the palette index, padded to 4 bytes
+				const byte* src = reinterpret_cast<const byte*>(data.vertexData);
+				byte* dst = _currentVertexBuffer;
+				byte* endPtr = dst + vertexDataSize;
+				int srcStride = currMaterial->_vertexStreamAttributes.stride;
+				while (dst < endPtr) {
+					memcpy(dst, src, srcStride);
+					dst[srcStride] = paletteIndex;
+					dst[srcStride + 1] = dst[srcStride + 2] = dst[srcStride + 3] = 0;
+					src += srcStride;
+					dst += vertexFormat->stride;
+				}
+			}
+			else {
+				memcpy(_currentVertexBuffer, data.vertexData, vertexDataSize);
+			}
+			if (transformOnCpu && !compact) {
 				// treat the first 12 byte (3 floats) as a Vec3 and transform it using the modelView
 				byte* ptr = _currentVertexBuffer;
 				byte* endPtr = ptr + vertexDataSize;
 				int stride = currMaterial->_vertexStreamAttributes.stride;
-				while (ptr < endPtr) {
-					Vec3* vec = reinterpret_cast<Vec3*>(ptr);
-					modelView.transformPoint(vec);
-					ptr += stride;
+				if (_isOpaque2DEnabled && _isDepthTestFor2D && !avc->is3D()) {
+					// the opaque 2d pass draws out of order, so z has to tell the depth test the order
+					float depth = avc->getDepth2D();
+					while (ptr < endPtr) {
+						Vec3* vec = reinterpret_cast<Vec3*>(ptr);
+						modelView.transformPoint(vec);
+						vec->z = depth;
+						ptr += stride;
+					}
+				}
+				else if (!modelView.isIdentity()) {
+					// commands that fold their transform into the vertices, like sprite batches, submit the identity
+					while (ptr < endPtr) {
+						Vec3* vec = reinterpret_cast<Vec3*>(ptr);
+						modelView.transformPoint(vec);
+						ptr += stride;
+					}
 				}
 			}
 			if (data.indexCount != 0) {
 				// copy index data
-				if (_filledVertex == 0) {
-					// special case when the vertex buffer offset is 0
+				if (emitIndices) {
+					// already written by the emitting command
+				}
+				else if (_filledVertex == 0 || _useBaseVertex) {
+					// special case when the vertex buffer offset is 0 or the offset is applied by the draw call
 					memcpy(_currentIndexBuffer, data.indexData, sizeof(short) * data.indexCount);
 				}
 				else {
@@ -591,6 +1178,12 @@ void Renderer::makeSingleRenderCommandList(std::vector<RenderCommand*> commands)
 						*(ptr++) = *(srcPtr++) + _filledVertex;
 					}
 				}
+				if (_useBaseVertex) {
+					_subDrawCounts->push_back_resize((GLsizei)data.indexCount);
+					_subDrawBaseVertices->push_back_resize(_filledVertex);
+					_subDrawFirstIndices->push_back_resize(_currentIndexBufferOffset - _vertexBatches->indexRange(_currentVertexBatchIndex).usageStart);
+					_vertexBatches->subDraws(_currentVertexBatchIndex).end = (int)_subDrawCounts->size();
+				}
 			}
 
 			// adjust buffers and offset
@@ -602,82 +1195,310 @@ void Renderer::makeSingleRenderCommandList(std::vector<RenderCommand*> commands)
 
 			_filledVertex += data.vertexCount;
 
-			// if newCommand is set create a new avc and init it
+			// the batch is drawn after the last command gathered into it
 			if (newCommand) {
-				ArbitraryVertexCommand* avc = _avcPool1->pop();
-
-				// the data value doesnt really matters here
-				avc->init(0, currMaterial, data, modelView, transformOnCpu, 0);
-
-				_currentAVCommandCount++;
-				_lastArbitraryCommand = avc;
-				_renderCommands->push_back_resize(avc);
-
-				_avcPool2->push(avc);
+				pushBatchPacket(modelView);
 			}
-			else {
-				// do nothing
-			}
-			_lastArbitraryCommand = avc;
 		}
 		else {
-			_lastWasFlushCommand = true;
 			if (type == RenderCommand::Type::GROUP_COMMAND) {
-				makeSingleRenderCommandList(_renderGroups[reinterpret_cast<GroupCommand*>(*i)->getRenderQueueID()]);
-				//_renderCommands->reserveElements(commands.size() - j);
+				int queueID = reinterpret_cast<GroupCommand*>(*i)->getRenderQueueID();
+				if (_isGroupMergingEnabled && _isIn2DState && isMergeableQueue(queueID)) {
+					// the markers would set the state that is already set, so the current batch just continues
+					mergeRenderQueue(_renderGroups[queueID]);
+					continue;
+				}
+				_lastWasFlushCommand = true;
+				makeSingleRenderCommandList(_renderGroups[queueID]);
+				//_drawPackets->reserveElements(commands.size() - j);
 				continue;
 			}
-			_renderCommands->push_back_resize(*i);
+			_lastWasFlushCommand = true;
+			pushCommandPacket(*i);
 			continue;
 		}
 	}
 }
 
 void Renderer::makeSingleRenderCommandList(RenderQueue& queue) {
-	//_renderCommands->reserveElements(7);
+	//_drawPackets->reserveElements(7);
 
-	CustomCommand* begin = _customCommandPool1->pop();
-	CustomCommand* end = _customCommandPool1->pop();
+	QueueStateCommand* begin = _queueStateCommandPool1->pop();
+	QueueStateCommand* end = _queueStateCommandPool1->pop();
 
-	begin->func = CC_CALLBACK_0(RenderQueue::saveRenderState, &queue);
-	_renderCommands->push_back_resize(begin);
+	begin->queue = &queue;
+	begin->save = true;
+	pushCommandPacket(begin);
 
-	std::vector<RenderCommand*> queueEntrys = queue.getSubQueue(RenderQueue::QUEUE_GROUP::GLOBALZ_NEG);
+	// opaque 2d commands only rely on the depth buffer, so they go first
+	std::vector<RenderCommand*> queueEntrys = queue.getSubQueue(RenderQueue::QUEUE_GROUP::OPAQUE_2D);
+	if (queueEntrys.size() > 0) {
+		pushCommandPacket(_beginQueueOpaqueCommand);
+		_lastWasFlushCommand = true;
+		makeSingleRenderCommandList(queueEntrys);
+	}
+	queueEntrys = queue.getSubQueue(RenderQueue::QUEUE_GROUP::GLOBALZ_NEG);
 	if (queueEntrys.size() > 0) {
-		_renderCommands->push_back_resize(_beginQueue2dCommand);
+		pushCommandPacket(_beginQueue2dCommand);
 		_lastWasFlushCommand = true;
+		_isIn2DState = true;
 		makeSingleRenderCommandList(queueEntrys);
 	}
 	queueEntrys = queue.getSubQueue(RenderQueue::QUEUE_GROUP::OPAQUE_3D);
 	if (queueEntrys.size() > 0) {
-		_renderCommands->push_back_resize(_beginQueueOpaqueCommand);
+		pushCommandPacket(_beginQueueOpaqueCommand);
 		_lastWasFlushCommand = true;
+		if (isMeshInstancingEnabled()) {
+			gatherMeshInstances(queueEntrys);
+		}
 		makeSingleRenderCommandList(queueEntrys);
 	}
 	queueEntrys = queue.getSubQueue(RenderQueue::QUEUE_GROUP::TRANSPARENT_3D);
 	if (queueEntrys.size() > 0) {
-		_renderCommands->push_back_resize(_beginQueueTransparentCommand);
+		pushCommandPacket(_beginQueueTransparentCommand);
 		_lastWasFlushCommand = true;
 		makeSingleRenderCommandList(queueEntrys);
 	}
 	queueEntrys = queue.getSubQueue(RenderQueue::QUEUE_GROUP::GLOBALZ_ZERO);
 	if (queueEntrys.size() > 0) {
-		_renderCommands->push_back_resize(_beginQueue2dCommand);
+		pushCommandPacket(_beginQueue2dCommand);
 		_lastWasFlushCommand = true;
+		_isIn2DState = true;
 		makeSingleRenderCommandList(queueEntrys);
 	}
 	queueEntrys = queue.getSubQueue(RenderQueue::QUEUE_GROUP::GLOBALZ_POS);
 	if (queueEntrys.size() > 0) {
-		_renderCommands->push_back_resize(_beginQueue2dCommand);
+		pushCommandPacket(_beginQueue2dCommand);
 		_lastWasFlushCommand = true;
+		_isIn2DState = true;
 		makeSingleRenderCommandList(queueEntrys);
 	}
 
-	end->func = CC_CALLBACK_0(RenderQueue::restoreRenderState, &queue);
-	_renderCommands->push_back_resize(end);
+	end->queue = &queue;
+	end->save = false;
+	pushCommandPacket(end);
 
-	_customCommandPool2->push(begin);
-	_customCommandPool2->push(end);
+	_queueStateCommandPool2->push(begin);
+	_queueStateCommandPool2->push(end);
+}
+
+bool Renderer::isMergeableQueue(int queueID)
+{
+	if (_mergeableQueues[queueID] >= 0) {
+		return _mergeableQueues[queueID] != 0;
+	}
+
+	// the 3d and opaque 2d parts set a different state
+	RenderQueue& queue = _renderGroups[queueID];
+	bool mergeable = queue.getSubQueueSize(RenderQueue::OPAQUE_2D) == 0 &&
+		queue.getSubQueueSize(RenderQueue::OPAQUE_3D) == 0 &&
+		queue.getSubQueueSize(RenderQueue::TRANSPARENT_3D) == 0;
+
+	// any other command may change the state the group would restore
+	static const RenderQueue::QUEUE_GROUP groups[] = { RenderQueue::GLOBALZ_NEG, RenderQueue::GLOBALZ_ZERO, RenderQueue::GLOBALZ_POS };
+	for (auto group : groups) {
+		for (auto command : queue.getSubQueue(group)) {
+			if (!mergeable) {
+				break;
+			}
+			auto type = command->getType();
+			if (type == RenderCommand::Type::GROUP_COMMAND) {
+				mergeable = isMergeableQueue(static_cast<GroupCommand*>(command)->getRenderQueueID());
+			}
+			else {
+				mergeable = type == RenderCommand::Type::ARBITRARY_VERTEX_COMMAND;
+			}
+		}
+	}
+
+	_mergeableQueues[queueID] = mergeable ? 1 : 0;
+	return mergeable;
+}
+
+void Renderer::mergeRenderQueue(RenderQueue& queue)
+{
+	_mergedGroups++;
+
+	// the same order the 2d parts have with their markers
+	static const RenderQueue::QUEUE_GROUP groups[] = { RenderQueue::GLOBALZ_NEG, RenderQueue::GLOBALZ_ZERO, RenderQueue::GLOBALZ_POS };
+	for (auto group : groups) {
+		std::vector<RenderCommand*>& queueEntrys = queue.getSubQueue(group);
+		if (queueEntrys.size() > 0) {
+			makeSingleRenderCommandList(queueEntrys);
+		}
+	}
+}
+
+void Renderer::setInstancedProgram(GLProgram* program, GLProgramState* instancedProgramState)
+{
+	CCASSERT(program, "Invalid program");
+	auto it = _instancedPrograms.find(program);
+	if (it != _instancedPrograms.end()) {
+		it->second->release();
+		_instancedPrograms.erase(it);
+	}
+	if (instancedProgramState) {
+		instancedProgramState->retain();
+		_instancedPrograms[program] = instancedProgramState;
+	}
+}
+
+void Renderer::bindInstanceAttribLocations(GLProgram* program)
+{
+	program->bindAttribLocation("a_instanceModelView", INSTANCE_ATTRIB_MODEL_VIEW);
+	program->bindAttribLocation("a_instanceColor", INSTANCE_ATTRIB_COLOR);
+}
+
+GLProgramState* Renderer::getInstancedProgramState(MeshCommand* mesh)
+{
+	// material based meshes have no program state of their own, every pass binds its own
+	GLProgramState* programState = mesh->getGLProgramState();
+	if (mesh->isSkipBatching() || programState == nullptr) {
+		return nullptr;
+	}
+	auto it = _instancedPrograms.find(programState->getGLProgram());
+	return it != _instancedPrograms.end() ? it->second : nullptr;
+}
+
+void Renderer::gatherMeshInstances(std::vector<RenderCommand*>& commands) {
+	if (_instancedPrograms.empty()) {
+		return;
+	}
+
+	// only runs of mesh commands are grouped, a custom or group command in between can change the state
+	// or rely on the meshes before it. a group never takes more commands than it replaces, so the queue is compacted in place
+	auto out = commands.begin();
+	auto runStart = commands.begin();
+	while (runStart != commands.end()) {
+		if ((*runStart)->getType() != RenderCommand::Type::MESH_COMMAND) {
+			*(out++) = *(runStart++);
+			continue;
+		}
+		auto runEnd = runStart;
+		while (runEnd != commands.end() && (*runEnd)->getType() == RenderCommand::Type::MESH_COMMAND) {
+			runEnd++;
+		}
+		out = gatherMeshInstanceRun(runStart, runEnd, out);
+		runStart = runEnd;
+	}
+	commands.erase(out, commands.end());
+}
+
+std::vector<RenderCommand*>::iterator Renderer::gatherMeshInstanceRun(std::vector<RenderCommand*>::iterator begin, std::vector<RenderCommand*>::iterator end, std::vector<RenderCommand*>::iterator out) {
+	// the material id of a MeshCommand covers texture, program state, blend func and the vertex and index buffer,
+	// so commands with equal ids draw the same mesh the same way
+	_meshInstanceCounts.clear();
+	for (auto in = begin; in != end; in++) {
+		MeshCommand* mesh = static_cast<MeshCommand*>(*in);
+		if (getInstancedProgramState(mesh)) {
+			_meshInstanceCounts[mesh->getMaterialID()]++;
+		}
+	}
+
+	// the meshes are depth tested, so the instances of a group can be drawn at the position of its first command
+	_meshInstanceGroupOfMaterial.clear();
+	for (auto in = begin; in != end; in++) {
+		MeshCommand* mesh = static_cast<MeshCommand*>(*in);
+		GLProgramState* instancedProgramState = getInstancedProgramState(mesh);
+		if (instancedProgramState) {
+			auto count = _meshInstanceCounts.find(mesh->getMaterialID());
+			if (count->second > 1) {
+				auto groupIt = _meshInstanceGroupOfMaterial.find(mesh->getMaterialID());
+				int groupIndex;
+				if (groupIt == _meshInstanceGroupOfMaterial.end()) {
+					MeshInstanceGroup group;
+					group.programState = instancedProgramState;
+					group.start = (int)_meshInstanceCommands.size();
+					group.count = 0;
+					groupIndex = (int)_meshInstanceGroups.size();
+					_meshInstanceGroups.push_back(group);
+					_meshInstanceCommands.resize(_meshInstanceCommands.size() + count->second);
+					_meshInstanceGroupOfMaterial[mesh->getMaterialID()] = groupIndex;
+
+					CustomCommand* draw = _customCommandPool1->pop();
+					draw->func = CC_CALLBACK_0(Renderer::drawMeshInstances, this, groupIndex);
+					_customCommandPool2->push(draw);
+					*(out++) = draw;
+				}
+				else {
+					groupIndex = groupIt->second;
+				}
+				MeshInstanceGroup& group = _meshInstanceGroups[groupIndex];
+				_meshInstanceCommands[group.start + group.count++] = mesh;
+				continue;
+			}
+		}
+		*(out++) = mesh;
+	}
+	return out;
+}
+
+void Renderer::drawMeshInstances(int groupIndex) {
+	const MeshInstanceGroup& group = _meshInstanceGroups[groupIndex];
+	MeshCommand* first = _meshInstanceCommands[group.start];
+
+	// model view columns, followed by the color if enabled
+	int floatsPerInstance = _useMeshInstanceColors ? 20 : 16;
+	GLsizei stride = floatsPerInstance * sizeof(float);
+	_meshInstanceData.resize(group.count * floatsPerInstance);
+	float* data = _meshInstanceData.data();
+	for (int i = 0; i < group.count; i++) {
+		MeshCommand* mesh = _meshInstanceCommands[group.start + i];
+		memcpy(data, mesh->getModelView().m, sizeof(float) * 16);
+		if (_useMeshInstanceColors) {
+			const Vec4& color = mesh->getDisplayColor();
+			data[16] = color.x;
+			data[17] = color.y;
+			data[18] = color.z;
+			data[19] = color.w;
+		}
+		data += floatsPerInstance;
+	}
+
+	if (_meshInstanceVBO == 0) {
+		_device->genBuffers(1, &_meshInstanceVBO);
+	}
+	_device->bindBuffer(GL_ARRAY_BUFFER, _meshInstanceVBO);
+	_device->bufferData(GL_ARRAY_BUFFER, group.count * stride, _meshInstanceData.data(), GL_STREAM_DRAW);
+	_uploadedBytes += group.count * stride;
+	_uploadCalls++;
+
+	// preBatchDraw only binds the mesh buffers and its attributes. the texture and the render state, blend func included,
+	// are applied by batchDraw, which draws a single mesh, so they are applied here
+	first->preBatchDraw();
+	_device->applyProgram(group.programState, Mat4::IDENTITY);
+	first->getStateBlock()->bind();
+	_device->bindTexture2DN(0, first->getTextureID());
+
+	// preBatchDraw bound the mesh vertex buffer, the instance attributes read from the instance buffer
+	_device->bindBuffer(GL_ARRAY_BUFFER, _meshInstanceVBO);
+	for (GLuint i = 0; i < 4; i++) {
+		_device->enableVertexAttribArray(INSTANCE_ATTRIB_MODEL_VIEW + i);
+		_device->vertexAttribPointer(INSTANCE_ATTRIB_MODEL_VIEW + i, 4, GL_FLOAT, GL_FALSE, stride, (GLvoid*)(sizeof(float) * 4 * i));
+		_device->vertexAttribDivisor(INSTANCE_ATTRIB_MODEL_VIEW + i, 1);
+	}
+	if (_useMeshInstanceColors) {
+		_device->enableVertexAttribArray(INSTANCE_ATTRIB_COLOR);
+		_device->vertexAttribPointer(INSTANCE_ATTRIB_COLOR, 4, GL_FLOAT, GL_FALSE, stride, (GLvoid*)(sizeof(float) * 16));
+		_device->vertexAttribDivisor(INSTANCE_ATTRIB_COLOR, 1);
+	}
+
+	_device->drawElementsInstanced(first->getPrimitiveType(), (GLsizei)first->getIndexCount(), first->getIndexFormat(), 0, group.count);
+
+	// the instance attributes are not known to the gl state cache, reset them so no other draw reads them
+	for (GLuint i = 0; i < 4; i++) {
+		_device->vertexAttribDivisor(INSTANCE_ATTRIB_MODEL_VIEW + i, 0);
+		_device->disableVertexAttribArray(INSTANCE_ATTRIB_MODEL_VIEW + i);
+	}
+	if (_useMeshInstanceColors) {
+		_device->vertexAttribDivisor(INSTANCE_ATTRIB_COLOR, 0);
+		_device->disableVertexAttribArray(INSTANCE_ATTRIB_COLOR);
+	}
+	first->postBatchDraw();
+	_device->bindBuffer(GL_ARRAY_BUFFER, 0);
+
+	_drawnBatches++;
+	_drawnVertices += first->getIndexCount() * group.count;
 }
 
 #define SWAP(a, b, t, n) t n = a; \
@@ -685,21 +1506,21 @@ void Renderer::makeSingleRenderCommandList(RenderQueue& queue) {
 					b = n
 
 void Renderer::initVertexGathering() {
+	_batchBreakStats->clear();
+	_largestCommandVertexBytes = 0;
+
 	_currentVertexBatchIndex = 0;
+	_previousVertexBatchIndex = 0;
 
 	_currentMaterial2dId = 0;
+	_currentVertexFormat = nullptr;
 	_lastMaterial_skipBatching = false;
 	_firstAVC = true;
 	_lastWasFlushCommand = false;
-	_lastCommandWasIndexed = false;
 
 	_filledVertex = 0;
 	_filledIndex = 0;
 
-	memset(_vertexBatches->pointerAt(0), 0, sizeof(VertexBatch));
-	_previousVertexBatch = _vertexBatches->pointerAt(0);
-	_currentVertexBatch = _previousVertexBatch;
-
 	_currentIndexBuffer = _arbitraryIndexBuffer;
 	_currentVertexBuffer = _arbitraryVertexBuffer;
 	_currentIndexBufferOffset = 0;
@@ -707,35 +1528,35 @@ void Renderer::initVertexGathering() {
 
 	_lastVertexBufferSlicePos = 0;
 
-	_currentAVCommandCount = 0;
-
-	_lastArbitraryCommand = nullptr;
-
 	_currentVBOIsWritten = false;
 
 	_lastAVC_was_NCT = false;
 
+	_usedVboSlices = 0;
+
+	_isIn2DState = false;
+	_mergeableQueues.assign(_renderGroups.size(), -1);
+	_mergedGroups = 0;
+
 	// swap the pools
 	if (_customCommandPool1->getElementCount() < _customCommandPool2->getElementCount()) {
 		SWAP(_customCommandPool1, _customCommandPool2, FastPool<CustomCommand*>*, temp1);
 	}
-	if (_avcPool1->getElementCount() < _avcPool2->getElementCount()) {
-		SWAP(_avcPool1, _avcPool2, FastPool<ArbitraryVertexCommand*>*, temp3);
+	if (_queueStateCommandPool1->getElementCount() < _queueStateCommandPool2->getElementCount()) {
+		SWAP(_queueStateCommandPool1, _queueStateCommandPool2, FastPool<QueueStateCommand*>*, temp2);
 	}
+	_customCommandPool1->resetTakenCount();
+	_queueStateCommandPool1->resetTakenCount();
 
-	// init draw stuff
-
-	_startDrawIndex = 0;
-	_currentDrawnRenderCommands = 0;
-	_currentDrawnVertexBatches = 0;
+	_isDrawingBatches = false;
 }
 
 // queue command functions
 
 void Renderer::beginQueueTransparent() {
-	glEnable(GL_DEPTH_TEST);
-	glDepthMask(false);
-	glEnable(GL_BLEND);
+	_device->enable(GL_DEPTH_TEST);
+	_device->depthMask(false);
+	_device->enable(GL_BLEND);
 
 	RenderState::StateBlock::_defaultState->setDepthTest(true);
 	RenderState::StateBlock::_defaultState->setDepthWrite(false);
@@ -744,18 +1565,18 @@ void Renderer::beginQueueTransparent() {
 void Renderer::beginQueue2d() {
 	if (_isDepthTestFor2D)
 	{
-		glEnable(GL_DEPTH_TEST);
-		glDepthMask(true);
-		glEnable(GL_BLEND);
+		_device->enable(GL_DEPTH_TEST);
+		_device->depthMask(true);
+		_device->enable(GL_BLEND);
 		RenderState::StateBlock::_defaultState->setDepthTest(true);
 		RenderState::StateBlock::_defaultState->setDepthWrite(true);
 		RenderState::StateBlock::_defaultState->setBlend(true);
 	}
 	else
 	{
-		glDisable(GL_DEPTH_TEST);
-		glDepthMask(false);
-		glEnable(GL_BLEND);
+		_device->disable(GL_DEPTH_TEST);
+		_device->depthMask(false);
+		_device->enable(GL_BLEND);
 		RenderState::StateBlock::_defaultState->setDepthTest(false);
 		RenderState::StateBlock::_defaultState->setDepthWrite(false);
 		RenderState::StateBlock::_defaultState->setBlend(true);
@@ -763,9 +1584,9 @@ void Renderer::beginQueue2d() {
 }
 void Renderer::beginQueueOpaque() {
 	//Clear depth to achieve layered rendering
-	glEnable(GL_DEPTH_TEST);
-	glDepthMask(true);
-	glDisable(GL_BLEND);
+	_device->enable(GL_DEPTH_TEST);
+	_device->depthMask(true);
+	_device->disable(GL_BLEND);
 	RenderState::StateBlock::_defaultState->setDepthTest(true);
 	RenderState::StateBlock::_defaultState->setDepthWrite(true);
 	RenderState::StateBlock::_defaultState->setBlend(false);
@@ -776,9 +1597,10 @@ void Renderer::beginQueueOpaque() {
 void Renderer::processRenderCommand(RenderCommand* command)
 {
 	auto commandType = command->getType();
-	if (RenderCommand::Type::ARBITRARY_VERTEX_COMMAND == commandType) {
-		// TODO use FastVector
-		_batchedArbitaryCommands.push_back(command);
+	if (_isHeadless)
+	{
+		// every other command needs a gl context, only end the current batch
+		flush();
 	}
 	else if (RenderCommand::Type::MESH_COMMAND == commandType)
 	{
@@ -807,24 +1629,40 @@ void Renderer::processRenderCommand(RenderCommand* command)
 		{
 			cmd->batchDraw();
 		}
+		// mesh commands set their state with raw gl
+		_device->invalidateStateCache();
 	}
 	else if (RenderCommand::Type::CUSTOM_COMMAND == commandType)
 	{
 		flush();
 		auto cmd = static_cast<CustomCommand*>(command);
 		cmd->execute();
+		_device->invalidateStateCache();
 	}
 	else if (RenderCommand::Type::BATCH_COMMAND == commandType)
 	{
 		flush();
 		auto cmd = static_cast<BatchCommand*>(command);
 		cmd->execute();
+		_device->invalidateStateCache();
 	}
 	else if (RenderCommand::Type::PRIMITIVE_COMMAND == commandType)
 	{
 		flush();
 		auto cmd = static_cast<PrimitiveCommand*>(command);
 		cmd->execute();
+		_device->invalidateStateCache();
+	}
+	else if ((RenderCommand::Type)QueueStateCommand::QUEUE_STATE_COMMAND == commandType)
+	{
+		flush();
+		auto cmd = static_cast<QueueStateCommand*>(command);
+		if (cmd->save) {
+			cmd->queue->saveRenderState(_device);
+		}
+		else {
+			cmd->queue->restoreRenderState(_device);
+		}
 	}
 	else if ((RenderCommand::Type)QueueCommand::QUEUE_COMMAND == commandType)
 	{
@@ -853,30 +1691,77 @@ void Renderer::render()
 
 	if (_glViewAssigned)
 	{
+		ssize_t uploadedBytes = _uploadedBytes;
+		ssize_t uploadCalls = _uploadCalls;
+
+		_device->beginFrame();
+		CC_RENDERER_PROFILE_BEGIN_FRAME(_profiler, _drawnBatches, _drawnVertices);
+
 		//Process render commands
 		//1. Sort render commands based on ID
-		for (auto &renderqueue : _renderGroups)
 		{
-			renderqueue.sort();
+			CC_RENDERER_PROFILE_PHASE(_profiler, RENDERER_PHASE_SORT);
+			if (!_depth2DCommands.empty()) {
+				// before the sort, the opaque 2d group is ordered by these depths
+				assignDepth2D();
+			}
+			for (auto &renderqueue : _renderGroups)
+			{
+				renderqueue.sort();
+			}
+		}
+		if (!_captureFramePath.empty()) {
+			if (!FrameCapture::writeToFile(_renderGroups, _captureFramePath)) {
+				CCLOG("Could not write the frame capture to %s", _captureFramePath.c_str());
+			}
+			_captureFramePath.clear();
 		}
 		//2. 
 		//	1. convert all render queues into one giant list of render command
 		//	2. convert all TrianglesCommands and QuadCommands to ArbitraryVertexCommand
 		//	3. create batching data
-		initVertexGathering();
-		makeSingleRenderCommandList(_renderGroups[0]);
-		_vertexBatches->pointerAt(_currentVertexBatchIndex)->endRCIndex = _currentAVCommandCount;
-		_vertexBatches->pointerAt(_currentVertexBatchIndex)->indexBufferUsageEnd = _currentIndexBufferOffset;
-		_vertexBatches->pointerAt(_currentVertexBatchIndex)->vertexBufferUsageEnd = _currentVertexBufferOffset;
+		{
+			CC_RENDERER_PROFILE_PHASE(_profiler, RENDERER_PHASE_GATHER);
+			_occludedCommands = _occludedVertices = 0;
+			if (_isOcclusionCullingEnabled && !_isDepthTestFor2D) {
+				cullOccludedCommands(_renderGroups[0]);
+			}
+			initVertexGathering();
+			makeSingleRenderCommandList(_renderGroups[0]);
+			if (_vertexBatches->size() > 0) {
+				_vertexBatches->indexRange(_currentVertexBatchIndex).usageEnd = _currentIndexBufferOffset;
+				_vertexBatches->vertexRange(_currentVertexBatchIndex).usageEnd = _currentVertexBufferOffset;
+			}
+		}
 		//3. map buffers
-		mapArbitraryBuffers();
+		{
+			CC_RENDERER_PROFILE_PHASE(_profiler, RENDERER_PHASE_MAP_BUFFERS);
+			auto uploadStart = std::chrono::steady_clock::now();
+			mapArbitraryBuffers();
+			_uploadNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - uploadStart).count();
+		}
 		//4. process render commands
-		RenderCommand** commandPtr = const_cast<RenderCommand**>(_renderCommands->cbegin());
-		RenderCommand** endPtr = const_cast<RenderCommand**>(_renderCommands->cend());
-
-		while (commandPtr < endPtr) {
-			processRenderCommand(*(commandPtr++)); // cast away the const
+		{
+			CC_RENDERER_PROFILE_PHASE(_profiler, RENDERER_PHASE_DRAW);
+			resolveDrawPackets();
+
+			const DrawPacket* packet = _drawPackets->cbegin();
+			const DrawPacket* endPacket = _drawPackets->cend();
+			for (; packet < endPacket; packet++) {
+				if (packet->type == DRAW_PACKET_BATCH) {
+					drawBatchPacket(*packet);
+				}
+				else if (packet->type == DRAW_PACKET_COMMAND) {
+					processRenderCommand(packet->command);
+				}
+			}
 		}
+		CC_RENDERER_PROFILE_END_FRAME(_profiler, _drawnBatches, _drawnVertices);
+
+		//5. adjust the buffers for the next frame, the stats see the buffers the frame was gathered into
+		recordMemoryStats(_uploadedBytes - uploadedBytes, _uploadCalls - uploadCalls);
+		tuneBuffers();
+		budgetBuffers();
 	}
 	clean();
 	_isRendering = false;
@@ -896,10 +1781,17 @@ void Renderer::clean()
 	}
 
 	_vertexBatches->clear();
-	_renderCommands->clear();
+	_drawPackets->clear();
+
+	_subDrawCounts->clear();
+	_subDrawBaseVertices->clear();
+	_subDrawFirstIndices->clear();
+	_paletteMatrices->clear();
+
+	_meshInstanceGroups.clear();
+	_meshInstanceCommands.clear();
+	_depth2DCommands.clear();
 
-	// Clear batch commands
-	_batchedArbitaryCommands.clear();
 	_filledVertex = 0;
 	_filledIndex = 0;
 	_lastBatchedMeshCommand = nullptr;
@@ -908,10 +1800,10 @@ void Renderer::clean()
 void Renderer::clear()
 {
 	//Enable Depth mask to make sure glClear clear the depth buffer correctly
-	glDepthMask(true);
-	glClearColor(_clearColor.r, _clearColor.g, _clearColor.b, _clearColor.a);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glDepthMask(false);
+	_device->depthMask(true);
+	_device->clearColor(_clearColor.r, _clearColor.g, _clearColor.b, _clearColor.a);
+	_device->clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	_device->depthMask(false);
 
 	RenderState::StateBlock::_defaultState->setDepthWrite(false);
 }
@@ -920,9 +1812,9 @@ void Renderer::setDepthTest(bool enable)
 {
 	if (enable)
 	{
-		glClearDepth(1.0f);
-		glEnable(GL_DEPTH_TEST);
-		glDepthFunc(GL_LEQUAL);
+		_device->clearDepth(1.0f);
+		_device->enable(GL_DEPTH_TEST);
+		_device->depthFunc(GL_LEQUAL);
 
 		RenderState::StateBlock::_defaultState->setDepthTest(true);
 		RenderState::StateBlock::_defaultState->setDepthFunction(RenderState::DEPTH_LEQUAL);
@@ -931,7 +1823,7 @@ void Renderer::setDepthTest(bool enable)
 	}
 	else
 	{
-		glDisable(GL_DEPTH_TEST);
+		_device->disable(GL_DEPTH_TEST);
 
 		RenderState::StateBlock::_defaultState->setDepthTest(false);
 	}
@@ -940,6 +1832,13 @@ void Renderer::setDepthTest(bool enable)
 	CHECK_GL_ERROR_DEBUG();
 }
 
+void Renderer::setOpaque2DDepthRange(float nearZ, float farZ)
+{
+	CCASSERT(nearZ < farZ, "Invalid depth range");
+	_opaque2DNearZ = nearZ;
+	_opaque2DFarZ = farZ;
+}
+
 void Renderer::fillVerticesAndIndices(const TrianglesCommand* cmd)
 {
 }
@@ -948,32 +1847,34 @@ void Renderer::fillQuads(const QuadCommand *cmd)
 {
 }
 
+void Renderer::setDirtyRangeUploadsEnabled(bool enable)
+{
+	if (enable && !_useDirtyRangeUploads) {
+		// the buffers were written round robin, so their contents dont match the trackers anymore
+		for (unsigned int i = 0; i < _vboCount * 2; i++) {
+			_vboDirtyTrackers[i].invalidate();
+		}
+	}
+	_useDirtyRangeUploads = enable;
+}
+
 void Renderer::mapArbitraryBuffers() {
+	if (_useDirtyRangeUploads) {
+		// slice n of a frame always goes into vbo n, so it can be compared with slice n of the last frame
+		_vboIndex = 0;
+	}
+
 	if (!_isBufferSlicing) {
 		if (_currentVertexBufferOffset > 0) {
-			glBindBuffer(GL_ARRAY_BUFFER, _aBufferVBOs[_vboIndex].buffers[0]);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _aBufferVBOs[_vboIndex].buffers[1]);
-
-			if (_useMapBuffer) {
-				glBufferData(GL_ARRAY_BUFFER, _currentVertexBufferOffset, nullptr, GL_STREAM_DRAW);
-				void* ptr = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
-				memcpy(ptr, _arbitraryVertexBuffer, _currentVertexBufferOffset);
-				glUnmapBuffer(GL_ARRAY_BUFFER);
-
-				glBufferData(GL_ELEMENT_ARRAY_BUFFER, _currentIndexBufferOffset * sizeof(short), nullptr, GL_STREAM_DRAW);
-				ptr = glMapBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_WRITE_ONLY);
-				memcpy(ptr, _arbitraryIndexBuffer, _currentIndexBufferOffset * sizeof(short));
-				glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
-			}
-			else {
-				glBufferData(GL_ARRAY_BUFFER, _currentVertexBufferOffset, _arbitraryVertexBuffer, GL_STREAM_DRAW);
-				glBufferData(GL_ELEMENT_ARRAY_BUFFER, _currentIndexBufferOffset * sizeof(short), _arbitraryIndexBuffer, GL_STREAM_DRAW);
-			}
-
-			for (auto i = _vertexBatches->cbegin(); i < _vertexBatches->cend(); i++) {
-				VertexBatch* batch = const_cast<VertexBatch*>(i);
-				batch->vertexBufferHandle = _aBufferVBOs[_vboIndex].buffers[0];
-				batch->indexBufferHandle = _aBufferVBOs[_vboIndex].buffers[1];
+			uploadArbitraryBuffers(_vboIndex, _arbitraryVertexBuffer, _currentVertexBufferOffset, _arbitraryIndexBuffer, _currentIndexBufferOffset);
+
+			for (size_t c = 0; c < _vertexBatches->getChunkCount(); c++) {
+				VertexBatchBufferHandles* handles = _vertexBatches->chunkAt(c)->buffers;
+				VertexBatchBufferHandles* handlesEnd = handles + _vertexBatches->getCountInChunk(c);
+				for (; handles < handlesEnd; handles++) {
+					handles->vertexBufferHandle = _aBufferVBOs[_vboIndex].buffers[0];
+					handles->indexBufferHandle = _aBufferVBOs[_vboIndex].buffers[1];
+				}
 			}
 			nextVBO();
 		}
@@ -995,126 +1896,247 @@ void Renderer::mapArbitraryBuffers() {
 			ssize_t vertexSize = 0;
 			ssize_t indexSize = 0;
 
-			VertexBatch* batch = nullptr;
+			// stream over the batch chunks, only the buffer ranges and handles are touched here
+			for (size_t c = 0; c < _vertexBatches->getChunkCount(); c++) {
+				VertexBatchList::Chunk* chunk = _vertexBatches->chunkAt(c);
+				VertexBatchBufferRange* vertexRange = chunk->vertexRanges;
+				VertexBatchBufferRange* indexRange = chunk->indexRanges;
+				VertexBatchBufferHandles* handles = chunk->buffers;
+				VertexBatchBufferHandles* handlesEnd = handles + _vertexBatches->getCountInChunk(c);
 
-			if (_currentVertexBufferOffset > _vboByteSlice) {
-				vertexSize = 0;
-			}
-
-			for (auto i = _vertexBatches->cbegin(); i < _vertexBatches->cend(); i++) {
-				batch = const_cast<VertexBatch*>(i);
-				ssize_t endOffset = batch->vertexBufferUsageEnd;
+				for (; handles < handlesEnd; handles++, vertexRange++, indexRange++) {
+					ssize_t endOffset = vertexRange->usageEnd;
 
-				if (endOffset - currentVertexBufferOffset > _vboByteSlice) {
-					glBindBuffer(GL_ARRAY_BUFFER, _aBufferVBOs[_vboIndex].buffers[0]);
-					glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _aBufferVBOs[_vboIndex].buffers[1]);
-					glBufferData(GL_ARRAY_BUFFER, vertexSize, _arbitraryVertexBuffer + currentVertexBufferOffset, GL_STREAM_DRAW);
-					glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexSize * sizeof(short), (_arbitraryIndexBuffer + currentIndexBufferOffset), GL_STREAM_DRAW);
+					if (endOffset - currentVertexBufferOffset > _vboByteSlice) {
+						uploadArbitraryBuffers(_vboIndex, _arbitraryVertexBuffer + currentVertexBufferOffset, vertexSize, _arbitraryIndexBuffer + currentIndexBufferOffset, indexSize);
 
-					currentVertexBufferOffset = batch->vertexBufferOffset;
-					currentIndexBufferOffset = batch->indexBufferOffset;
+						currentVertexBufferOffset = vertexRange->offset;
+						currentIndexBufferOffset = indexRange->offset;
 
-					vertexSize = 0;
-					indexSize = 0;
+						vertexSize = 0;
+						indexSize = 0;
 
-					nextVBO();
+						nextVBO();
+					}
+					handles->indexBufferHandle = _aBufferVBOs[_vboIndex].buffers[1];
+					handles->vertexBufferHandle = _aBufferVBOs[_vboIndex].buffers[0];
+
+					vertexSize += vertexRange->usageEnd - vertexRange->usageStart;
+					indexSize += indexRange->usageEnd - indexRange->usageStart;
+
+					vertexRange->offset -= currentVertexBufferOffset;
+					indexRange->offset -= currentIndexBufferOffset;
+					vertexRange->usageStart -= currentVertexBufferOffset;
+					indexRange->usageStart -= currentIndexBufferOffset;
+					vertexRange->usageEnd -= currentVertexBufferOffset;
+					indexRange->usageEnd -= currentIndexBufferOffset;
 				}
-				batch->indexBufferHandle = _aBufferVBOs[_vboIndex].buffers[1];
-				batch->vertexBufferHandle = _aBufferVBOs[_vboIndex].buffers[0];
-
-				vertexSize += batch->vertexBufferUsageEnd - batch->vertexBufferUsageStart;
-				indexSize += batch->indexBufferUsageEnd - batch->indexBufferUsageStart;
-
-				batch->vertexBufferOffset -= currentVertexBufferOffset;
-				batch->indexBufferOffset -= currentIndexBufferOffset;
-				batch->vertexBufferUsageStart -= currentVertexBufferOffset;
-				batch->indexBufferUsageStart -= currentIndexBufferOffset;
-				batch->vertexBufferUsageEnd -= currentVertexBufferOffset;
-				batch->indexBufferUsageEnd -= currentIndexBufferOffset;
 			}
 
 			// submit remaining data
-			glBindBuffer(GL_ARRAY_BUFFER, _aBufferVBOs[_vboIndex].buffers[0]);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _aBufferVBOs[_vboIndex].buffers[1]);
-			glBufferData(GL_ARRAY_BUFFER, vertexSize, _arbitraryVertexBuffer + currentVertexBufferOffset, GL_STREAM_DRAW);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexSize * sizeof(short), (_arbitraryIndexBuffer + currentIndexBufferOffset), GL_STREAM_DRAW);
+			uploadArbitraryBuffers(_vboIndex, _arbitraryVertexBuffer + currentVertexBufferOffset, vertexSize, _arbitraryIndexBuffer + currentIndexBufferOffset, indexSize);
 			nextVBO();
 		}
 	}
 }
 
-void Renderer::drawBatchedArbitaryVertices() {
-	int endDrawnRenderCommands = _currentDrawnRenderCommands + _batchedArbitaryCommands.size();
+void Renderer::uploadArbitraryBuffers(int vboIndex, const byte* vertices, ssize_t vertexSize, const GLushort* indices, ssize_t indexCount) {
+	ssize_t indexSize = indexCount * sizeof(GLushort);
+	_uploadedBytes += vertexSize + indexSize;
+	_usedVboSlices++;
+
+	_device->bindBuffer(GL_ARRAY_BUFFER, _aBufferVBOs[vboIndex].buffers[0]);
+	_device->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, _aBufferVBOs[vboIndex].buffers[1]);
+
+	ssize_t* bufferBytes = &_vboBufferBytes[vboIndex * 2];
+	if (_useDirtyRangeUploads && !_useMapBuffer) {
+		uploadDirtyRanges(GL_ARRAY_BUFFER, _vboDirtyTrackers[vboIndex * 2], vertices, vertexSize, bufferBytes[0]);
+		uploadDirtyRanges(GL_ELEMENT_ARRAY_BUFFER, _vboDirtyTrackers[vboIndex * 2 + 1], indices, indexSize, bufferBytes[1]);
+		return;
+	}
+
+	if (_useMapBuffer) {
+		_device->bufferData(GL_ARRAY_BUFFER, vertexSize, nullptr, GL_STREAM_DRAW);
+		void* ptr = _device->mapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+		memcpy(ptr, vertices, vertexSize);
+		_device->unmapBuffer(GL_ARRAY_BUFFER);
+
+		_device->bufferData(GL_ELEMENT_ARRAY_BUFFER, indexSize, nullptr, GL_STREAM_DRAW);
+		ptr = _device->mapBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_WRITE_ONLY);
+		memcpy(ptr, indices, indexSize);
+		_device->unmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+	}
+	else {
+		_device->bufferData(GL_ARRAY_BUFFER, vertexSize, vertices, GL_STREAM_DRAW);
+		_device->bufferData(GL_ELEMENT_ARRAY_BUFFER, indexSize, indices, GL_STREAM_DRAW);
+	}
+	_uploadCalls += 2;
+	bufferBytes[0] = vertexSize;
+	bufferBytes[1] = indexSize;
+}
+
+void Renderer::uploadDirtyRanges(GLenum target, BufferDirtyTracker& tracker, const void* data, ssize_t size, ssize_t& bufferBytes)
+{
+	// more than half dirty: respecifying the whole buffer is cheaper than the sub uploads
+	_dirtyRanges.clear();
+	if (!tracker.update(data, size, 0.5f, _dirtyRanges)) {
+		_device->bufferData(target, size, data, GL_STREAM_DRAW);
+		_uploadCalls++;
+		bufferBytes = size;
+		return;
+	}
 
-	int indexToDraw = 0;
-	int vertexCount = 0;
+	ssize_t uploaded = 0;
+	for (auto& range : _dirtyRanges) {
+		_device->bufferSubData(target, range.offset, range.size, reinterpret_cast<const byte*>(data) + range.offset);
+		uploaded += range.size;
+	}
+	_uploadCalls += _dirtyRanges.size();
+	_uploadedBytes -= size - uploaded;
+	_skippedUploadBytes += size - uploaded;
+}
 
-	VertexBatch* batch = _vertexBatches->pointerAt(_currentDrawnVertexBatches);
+void Renderer::pushBatchPacket(const Mat4& modelView)
+{
+	int& packetIndex = _vertexBatches->drawPacket(_currentVertexBatchIndex);
+	DrawPacket packet;
+	if (packetIndex >= 0) {
+		// the batch continues after a command, keep the model view of its first command
+		DrawPacket* previous = _drawPackets->pointerAt(packetIndex);
+		packet = *previous;
+		previous->type = DRAW_PACKET_NONE;
+	}
+	else {
+		packet.type = DRAW_PACKET_BATCH;
+		packet.state = 0;
+		packet.command = nullptr;
+		packet.batch = _currentVertexBatchIndex;
+		packet.modelView = modelView;
+	}
+	packetIndex = (int)_drawPackets->size();
+	_drawPackets->push_back_resize(packet);
+}
 
-	bool bindMaterial = true;
-	bool applyVertexAttribFormat = true;
-	bool bindBuffer = true;
+void Renderer::pushCommandPacket(RenderCommand* command)
+{
+	// queue markers included, beginQueue2d sets it again after pushing itself
+	_isIn2DState = false;
+
+	DrawPacket packet;
+	packet.type = DRAW_PACKET_COMMAND;
+	packet.state = 0;
+	packet.command = command;
+	packet.batch = -1;
+	_drawPackets->push_back_resize(packet);
+}
 
-	auto avcPtr = _batchedArbitaryCommands.begin();
+void Renderer::resolveDrawPackets()
+{
+	VertexBatchList* batches = _vertexBatches;
+	int previousBatch = -1;
+
+	DrawPacket* packet = _drawPackets->pointerAt(0);
+	DrawPacket* endPacket = packet + _drawPackets->size();
+	for (; packet < endPacket; packet++) {
+		if (packet->type == DRAW_PACKET_COMMAND) {
+			// the command may change any state, the next batch sets everything again
+			previousBatch = -1;
+			continue;
+		}
+		if (packet->type != DRAW_PACKET_BATCH) {
+			continue;
+		}
 
-	while (_currentDrawnRenderCommands < endDrawnRenderCommands) {
-		CCASSERT(_currentDrawnRenderCommands < _currentAVCommandCount, "Something went really wrong");
-		ArbitraryVertexCommand* avc = reinterpret_cast<ArbitraryVertexCommand*>(*avcPtr);
-		if (applyVertexAttribFormat) {
-			if (bindBuffer) {
-				glBindBuffer(GL_ARRAY_BUFFER, batch->vertexBufferHandle);
-				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->indexBufferHandle);
-			}
-			batch->material->_vertexStreamAttributes.apply((GLvoid*)batch->vertexBufferOffset);
+		int batch = packet->batch;
+		int state = 0;
+		if (previousBatch < 0 || batches->buffers(batch).vertexBufferHandle != batches->buffers(previousBatch).vertexBufferHandle) {
+			state |= DRAW_PACKET_BIND_BUFFERS | DRAW_PACKET_APPLY_FORMAT;
 		}
-		if (bindMaterial) {
-			batch->material->apply(avc->_mv);
+		else if (batches->vertexRange(batch).offset != batches->vertexRange(previousBatch).offset) {
+			state |= DRAW_PACKET_APPLY_FORMAT;
 		}
 
-		bindMaterial = applyVertexAttribFormat = bindBuffer = false;
-		_currentDrawnRenderCommands++;
-		avcPtr++;
-		if (_currentDrawnRenderCommands >= batch->endRCIndex) {
-			if (batch->indexed) {
-				indexToDraw = batch->indexBufferUsageEnd - batch->indexBufferUsageStart;
-				glDrawElements(
-					(GLenum)batch->material->_primitiveType,
-					(GLsizei)(indexToDraw),
-					GL_UNSIGNED_SHORT,
-					(GLvoid*)(batch->indexBufferUsageStart*sizeof(_arbitraryIndexBuffer[0])));
-				_drawnBatches++;
-				_drawnVertices += indexToDraw;
-			}
-			else {
-				indexToDraw = (batch->vertexBufferUsageEnd - batch->vertexBufferUsageStart) / batch->material->_vertexStreamAttributes.stride;
-				glDrawArrays((GLenum)batch->material->_primitiveType, 0, indexToDraw);
-				_drawnBatches++;
-				_drawnVertices += indexToDraw;
-			}
-			_currentDrawnVertexBatches++;
+		packet->mode = (GLenum)batches->material(batch)->_batchPrimitiveType;
+		if (batches->flags(batch) & VERTEX_BATCH_INDEXED) {
+			const VertexBatchBufferRange& indexRange = batches->indexRange(batch);
+			state |= DRAW_PACKET_INDEXED | (_useBaseVertex ? DRAW_PACKET_BASE_VERTEX : 0);
+			packet->count = (GLsizei)(indexRange.usageEnd - indexRange.usageStart);
+			packet->first = indexRange.usageStart * sizeof(_arbitraryIndexBuffer[0]);
+		}
+		else {
+			const VertexBatchBufferRange& vertexRange = batches->vertexRange(batch);
+			GLuint stride = batches->format(batch)->stride;
+			packet->count = (GLsizei)((vertexRange.usageEnd - vertexRange.usageStart) / stride);
+			// the batch may share its vertex offset with the previous one
+			packet->first = (vertexRange.usageStart - vertexRange.offset) / stride;
+		}
+		packet->state = state;
+		previousBatch = batch;
+	}
+}
 
-			if (_currentDrawnRenderCommands >= _currentAVCommandCount) { // _currentAVCommandCount is equal to the max avc command count at this point
-				break;
-			}
+void Renderer::drawBatchPacket(const DrawPacket& packet)
+{
+	VertexBatchList* batches = _vertexBatches;
+	int batch = packet.batch;
+
+	if (packet.state & DRAW_PACKET_BIND_BUFFERS) {
+		const VertexBatchBufferHandles& handles = batches->buffers(batch);
+		_device->bindBuffer(GL_ARRAY_BUFFER, handles.vertexBufferHandle);
+		_device->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, handles.indexBufferHandle);
+	}
+	if (packet.state & DRAW_PACKET_APPLY_FORMAT) {
+		batches->format(batch)->apply(_device, (GLvoid*)batches->vertexRange(batch).offset);
+	}
 
-			VertexBatch* newBatch = _vertexBatches->pointerAt(_currentDrawnVertexBatches);
+	Material2D* material = batches->material(batch);
+	material->apply(_device, packet.modelView);
+	const VertexBatchPaletteRange& palette = batches->palette(batch);
+	if (palette.end > palette.start) {
+		_device->uniformMatrix4fv(material->_paletteUniformLocation, palette.end - palette.start, GL_FALSE, _paletteMatrices->pointerAt(palette.start)->m);
+	}
 
-			if (newBatch->vertexBufferOffset != batch->vertexBufferOffset) {
-				// this means that the vertex attrib format must be changed
-				applyVertexAttribFormat = true;
-			}
-			if (newBatch->vertexBufferHandle != batch->vertexBufferHandle) {
-				// vbo changed means that the vertex attrib must be rebind
-				bindBuffer = applyVertexAttribFormat = true;
-				_startDrawIndex = 0;
-			}
-			batch = newBatch;
-			bindMaterial = true;
-		}
+	if (packet.state & DRAW_PACKET_BASE_VERTEX) {
+		drawBaseVertexBatch(batch, packet.mode);
+	}
+	else if (packet.state & DRAW_PACKET_INDEXED) {
+		_device->drawElements(packet.mode, packet.count, GL_UNSIGNED_SHORT, (GLvoid*)packet.first);
 	}
+	else {
+		_device->drawArrays(packet.mode, (GLint)packet.first, packet.count);
+	}
+	_drawnBatches++;
+	_drawnVertices += packet.count;
+	_isDrawingBatches = true;
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+void Renderer::drawBaseVertexBatch(int batch, GLenum primitiveType) {
+	const VertexBatchSubDrawRange& subDraws = _vertexBatches->subDraws(batch);
+	ssize_t indexStart = _vertexBatches->indexRange(batch).usageStart;
+	int subDrawCount = subDraws.end - subDraws.start;
+
+	if (subDrawCount == 1) {
+		_device->drawElementsBaseVertex(
+			primitiveType,
+			_subDrawCounts->at(subDraws.start),
+			GL_UNSIGNED_SHORT,
+			(GLvoid*)((indexStart + _subDrawFirstIndices->at(subDraws.start)) * sizeof(_arbitraryIndexBuffer[0])),
+			_subDrawBaseVertices->at(subDraws.start));
+	}
+	else if (subDrawCount > 1) {
+		// the index offsets are only known after the buffers are mapped, so they are made absolute here
+		_subDrawIndexOffsets->clear();
+		for (int i = subDraws.start; i < subDraws.end; i++) {
+			_subDrawIndexOffsets->push_back_resize((GLvoid*)((indexStart + _subDrawFirstIndices->at(i)) * sizeof(_arbitraryIndexBuffer[0])));
+		}
+		_device->multiDrawElementsBaseVertex(
+			primitiveType,
+			_subDrawCounts->pointerAt(subDraws.start),
+			GL_UNSIGNED_SHORT,
+			_subDrawIndexOffsets->pointerAt(0),
+			subDrawCount,
+			_subDrawBaseVertices->pointerAt(subDraws.start));
+	}
 }
 
 void Renderer::flush()
@@ -1134,14 +2156,17 @@ void Renderer::flush3D()
 	{
 		_lastBatchedMeshCommand->postBatchDraw();
 		_lastBatchedMeshCommand = nullptr;
+		_device->invalidateStateCache();
 	}
 }
 
 void Renderer::flushArbitaryVertices() {
-	if (_batchedArbitaryCommands.size() > 0)
+	// batches are drawn as soon as their packet is reached, only their buffers are left bound
+	if (_isDrawingBatches)
 	{
-		drawBatchedArbitaryVertices();
-		_batchedArbitaryCommands.clear();
+		_device->bindBuffer(GL_ARRAY_BUFFER, 0);
+		_device->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		_isDrawingBatches = false;
 	}
 }
 
@@ -28,6 +28,7 @@
 
 #include <vector>
 #include <stack>
+#include <unordered_map>
 
 #include "platform/CCPlatformMacros.h"
 #include "renderer/CCRenderCommand.h"
@@ -36,7 +37,18 @@
 
 #include "FastVector.h"
 #include "FastPool.h"
+#include "VertexBatchList.h"
+#include "CCDrawPacket.h"
 #include "Material2D.h"
+#include "CCRenderDevice.h"
+#include "CCRendererProfiler.h"
+#include "CCBatchBreakStats.h"
+#include "CCRendererBufferTuner.h"
+#include "CCRendererMemoryBudget.h"
+#include "CCRendererMemoryStats.h"
+#include "CCBufferDirtyTracker.h"
+#include "CCOcclusionCuller.h"
+#include "CCVertexFormatRegistry.h"
 
  /**
   * @addtogroup renderer
@@ -74,7 +86,9 @@ public:
 		GLOBALZ_ZERO = 3,
 		/**Objects with globalZ bigger than 0.*/
 		GLOBALZ_POS = 4,
-		QUEUE_COUNT = 5,
+		/**Opaque 2D objects of any globalZ, only used in the opaque 2d pass. Drawn before all other groups.*/
+		OPAQUE_2D = 5,
+		QUEUE_COUNT = 6,
 	};
 
 public:
@@ -82,6 +96,8 @@ public:
 	RenderQueue();
 	/**Push a renderCommand into current renderqueue.*/
 	void push_back(RenderCommand* command);
+	/**Push an opaque 2D ArbitraryVertexCommand into the opaque 2d group.*/
+	void pushBackOpaque2D(RenderCommand* command);
 	/**Return the number of render commands.*/
 	ssize_t size() const;
 	/**Sort the render commands.*/
@@ -98,9 +114,9 @@ public:
 	inline ssize_t getSubQueueSize(QUEUE_GROUP group) const { return _commands[group].size(); }
 
 	/**Save the current DepthState, CullState, DepthWriteState render state.*/
-	void saveRenderState();
+	void saveRenderState(RenderDevice* device);
 	/**Restore the saved DepthState, CullState, DepthWriteState render state.*/
-	void restoreRenderState();
+	void restoreRenderState(RenderDevice* device);
 
 protected:
 	/**The commands in the render queue.*/
@@ -132,28 +148,12 @@ class GroupCommandManager;
 
 typedef unsigned char byte;
 
-struct VertexBatch {
-	int startingRCIndex; // index indicating at which position this attribs should be used
-	int endRCIndex; // index indicating at which position the next RenderCommandsVertexAttribInfo should be used
-	ssize_t vertexBufferOffset; // an offset into the vbo
-	ssize_t vertexBufferUsageStart;
-	ssize_t vertexBufferUsageEnd;
-	GLuint vertexBufferHandle;
-	ssize_t indexBufferOffset;
-	ssize_t indexBufferUsageStart;
-	ssize_t indexBufferUsageEnd;
-	GLuint indexBufferHandle;
-
-	bool indexed;
-
-	Material2D* material;
-};
-
 struct VertexIndexBO {
 	GLuint buffers[2];
 };
 
 class QueueCommand;
+class QueueStateCommand;
 
 /* Class responsible for the rendering in.
 
@@ -170,6 +170,10 @@ public:
 	static const int BATCH_QUADCOMMAND_RESEVER_SIZE = 64;
 	/**Reserved for material id, which means that the command could not be batched.*/
 	static const int MATERIAL_ID_DO_NOT_BATCH = 0;
+	/**Attribute location of the per instance model view matrix of instanced meshes. Takes 4 locations, one per column.*/
+	static const GLuint INSTANCE_ATTRIB_MODEL_VIEW = 11;
+	/**Attribute location of the per instance color of instanced meshes.*/
+	static const GLuint INSTANCE_ATTRIB_COLOR = 15;
 
 	/**Constructor.*/
 	Renderer();
@@ -179,6 +183,17 @@ public:
 	//TODO: manage GLView inside Render itself
 	void initGLView();
 
+	/** Prepares the renderer for rendering without a gl context. Render commands are still sorted, gathered, batched and counted,
+	 but only ArbitraryVertexCommands are processed. Every device call goes to the given backend, or is dropped if it is nullptr.
+	 The backend is not owned by the renderer. Used for benchmarking and profiling */
+	void initHeadless(RenderDeviceBackend* backend = nullptr);
+
+	/** returns whether the renderer was initialized with initHeadless */
+	bool isHeadless() const { return _isHeadless; }
+
+	/** The device every gl call of the renderer goes through. Set a backend on it to record the calls */
+	RenderDevice* getRenderDevice() const { return _device; }
+
 	/** Adds a `RenderComamnd` into the renderer */
 	void addCommand(RenderCommand* command);
 
@@ -213,8 +228,32 @@ public:
 	ssize_t getDrawnVertices() const { return _drawnVertices; }
 	/* RenderCommands (except) QuadCommand should update this value */
 	void addDrawnVertices(ssize_t number) { _drawnVertices += number; };
+	/* returns the number of vertex and index bytes uploaded to gl buffers in the last frame */
+	ssize_t getUploadedBytes() const { return _uploadedBytes; }
+	/* returns the number of vertex bytes gathered in the last frame */
+	ssize_t getGatheredVertexBytes() const { return _gatheredVertexBytes; }
+	/* returns the number of vertex bytes saved by the compact vertex format in the last frame */
+	ssize_t getCompactVertexBytesSaved() const { return _compactVertexBytesSaved; }
+	/* returns the number of vertex and index bytes not uploaded in the last frame, because they matched the buffer contents */
+	ssize_t getSkippedUploadBytes() const { return _skippedUploadBytes; }
+	/* returns the number of glBufferData and glBufferSubData calls with data in the last frame */
+	ssize_t getUploadCalls() const { return _uploadCalls; }
 	/* clear draw stats */
-	void clearDrawStats() { _drawnBatches = _drawnVertices = 0; }
+	void clearDrawStats() { _drawnBatches = _drawnVertices = _uploadedBytes = _gatheredVertexBytes = _compactVertexBytesSaved = _skippedUploadBytes = _uploadCalls = 0; }
+	/* per phase timings of the last frames. only filled when compiled with CC_RENDERER_PROFILING */
+	RendererProfiler* getProfiler() const { return _profiler; }
+	/* memory and upload bandwidth counters of the last frames with their rolling min, average and max */
+	RendererMemoryStats* getMemoryStats() const { return _memoryStats; }
+	/* why the ArbitraryVertexCommands of the last frame were split into several draws */
+	BatchBreakStats* getBatchBreakStats() const { return _batchBreakStats; }
+	/* controls the vbo slice size and count. load a config into it to override the defaults */
+	RendererBufferTuner* getBufferTuner() const { return _bufferTuner; }
+	/* controls the capacity of the vertex and index buffers. enable it to start small and let the buffers follow the usage */
+	RendererMemoryBudget* getMemoryBudget() const { return _memoryBudget; }
+	/* returns the bytes of the cpu staging buffers: the gathered vertices and indices and the quad indices */
+	ssize_t getStagingBufferBytes() const;
+	/* returns the bytes of gl buffer storage held for the gathered vertices and indices, as last specified */
+	ssize_t getGpuBufferBytes() const;
 
 	/**
 	 * Enable/Disable depth test
@@ -223,6 +262,78 @@ public:
 	 */
 	void setDepthTest(bool enable);
 
+	/**
+	 * Enable/Disable the opaque 2d pass. Only has an effect while depth test for 2d is enabled.
+	 * Cpu transformed ArbitraryVertexCommands without blending are then drawn first, sorted by material and front to back,
+	 * as the depth buffer and not the submission order makes them correct. All other commands keep the ordered path.
+	 * The z of every cpu transformed 2d ArbitraryVertexCommand is set to its depth 2d, by default a unique value from its place
+	 * in the draw order of the ordered path (global order, then submission), so the depth test matches that order.
+	 */
+	void setOpaque2DEnabled(bool enable) { _isOpaque2DEnabled = enable; }
+	bool isOpaque2DEnabled() const { return _isOpaque2DEnabled; }
+	/**
+	 * The z range the default depths of the opaque 2d pass are spread over, the first command in the draw order gets the
+	 * lowest z. Has to lie within the clip range of the 2d projection. Defaults to -100 to 100.
+	 */
+	void setOpaque2DDepthRange(float nearZ, float farZ);
+
+	/**
+	 * Every slice always goes into the same vbo, which keeps the contents of the last frame.
+	 * Only the blocks that changed since then are uploaded with glBufferSubData, see getSkippedUploadBytes.
+	 * Pays off for mostly static scenes; the sub uploads can stall on buffers the gpu still reads, so dont use with very dynamic content.
+	 * Not used together with glMapBuffer.
+	 */
+	void setDirtyRangeUploadsEnabled(bool enable);
+	bool isDirtyRangeUploadsEnabled() const { return _useDirtyRangeUploads; }
+
+	/**
+	 * Skips 2d ArbitraryVertexCommands hidden behind opaque ones before their vertices are gathered.
+	 * Only commands with occlusion bounds can be skipped and only commands with an opaque rect hide others, see ArbitraryVertexCommand::setOcclusionBounds.
+	 * The main render queue is walked front to back, the rects are rasterized into the tile mask of the OcclusionCuller over the visible area.
+	 * Not used while the depth test for 2d is enabled, then the depth and not the order decides what is visible.
+	 */
+	void setOcclusionCullingEnabled(bool enable) { _isOcclusionCullingEnabled = enable; }
+	bool isOcclusionCullingEnabled() const { return _isOcclusionCullingEnabled; }
+	OcclusionCuller* getOcclusionCuller() const { return _occlusionCuller; }
+	/* returns the number of commands and their vertices skipped by occlusion culling in the last frame */
+	ssize_t getOccludedCommands() const { return _occludedCommands; }
+	ssize_t getOccludedVertices() const { return _occludedVertices; }
+
+	/**
+	 * Enable/Disable merging of groups into the surrounding batches. A GroupCommand whose queue only holds 2d ArbitraryVertexCommands
+	 * and such groups, reached while the state set for 2d is unchanged, would only save, set and restore that same state.
+	 * Its markers are left out then, so batches of the same material continue across the group boundaries. Enabled by default.
+	 */
+	void setGroupMergingEnabled(bool enable) { _isGroupMergingEnabled = enable; }
+	bool isGroupMergingEnabled() const { return _isGroupMergingEnabled; }
+	/* returns the number of groups merged into the surrounding batches in the last frame */
+	ssize_t getMergedGroups() const { return _mergedGroups; }
+
+	/**
+	 * Writes the sorted render queues of the next rendered frame to path, with materials, matrices and vertex and index data.
+	 * The file can be rendered again with FrameReplay, see CCFrameCapture.h for the format. An empty path cancels the capture.
+	 */
+	void captureNextFrame(const std::string& path) { _captureFramePath = path; }
+
+	/**
+	 * Enable/Disable instanced drawing of MeshCommands. MeshCommands in the opaque 3d queue that share their material id
+	 * (and with that mesh and material) and whose program has an instanced variant are drawn with one instanced call.
+	 * Only MeshCommands without other commands between them are grouped. Material based MeshCommands are not instanced.
+	 * Ignored when the gl context does not support instanced arrays.
+	 */
+	void setMeshInstancingEnabled(bool enable) { _isMeshInstancingEnabled = enable; }
+	bool isMeshInstancingEnabled() const { return _isMeshInstancingEnabled && _meshInstancingSupported; }
+	/**
+	 * Registers the program state used instead of the given program for instanced meshes, nullptr removes it.
+	 * The instanced program reads the model view from a_instanceModelView and, if enabled, the color from a_instanceColor.
+	 * The mesh, its texture and render state are set up from the first MeshCommand of the group, the instanced program is applied with an identity model view.
+	 */
+	void setInstancedProgram(GLProgram* program, GLProgramState* instancedProgramState);
+	/** whether the display color of every MeshCommand is uploaded as per instance color */
+	void setMeshInstanceColorsEnabled(bool enable) { _useMeshInstanceColors = enable; }
+	/** binds a_instanceModelView and a_instanceColor to the instance attribute locations. Call before the program is linked */
+	static void bindInstanceAttribLocations(GLProgram* program);
+
 	//This will not be used outside.
 	inline GroupCommandManager* getGroupCommandManager() const { return _groupCommandManager; };
 
@@ -236,7 +347,6 @@ protected:
 	void setupVBOAndVAO();
 	void setupVBO();
 	void mapBuffers();
-	void drawBatchedArbitaryVertices();
 
 	//Draw the previews queued quads and flush previous context
 	void flush();
@@ -259,9 +369,42 @@ protected:
 	void makeSingleRenderCommandList(std::vector<RenderCommand*> commands);
 
 	void mapArbitraryBuffers();
+	void uploadArbitraryBuffers(int vboIndex, const byte* vertices, ssize_t vertexSize, const GLushort* indices, ssize_t indexCount);
+	void uploadDirtyRanges(GLenum target, BufferDirtyTracker& tracker, const void* data, ssize_t size, ssize_t& bufferBytes);
+	// writes the indices of a strip, fan or loop as a list of the batch primitive type into _listIndices. indices may be null for non indexed data
+	void convertToListIndices(MaterialPrimitiveType type, const GLushort* indices, ssize_t count);
+	// turns the current batch into an indexed one by writing sequential indices for the vertices gathered into it so far
+	void indexCurrentBatch(GLuint vertexStride);
+	// removes the commands of the 2d groups that are hidden behind opaque ones
+	void cullOccludedCommands(RenderQueue& queue);
+	// spreads the default depth 2d of the frame's commands over the opaque 2d depth range in draw order
+	void assignDepth2D();
+	// whether the queue only holds 2d ArbitraryVertexCommands and groups of such queues, cached per frame
+	bool isMergeableQueue(int queueID);
+	// gathers the commands of a mergeable queue without its state markers
+	void mergeRenderQueue(RenderQueue& queue);
+
+	void setupQuadIndices();
 
 	inline void nextVertexBatch();
 
+	// appends the draw packet of the current batch, or moves it to the end of the stream if the batch already has one
+	void pushBatchPacket(const Mat4& modelView);
+	void pushCommandPacket(RenderCommand* command);
+	// fills in the state deltas and draw parameters of the batch packets, needs the mapped buffers
+	void resolveDrawPackets();
+	void drawBatchPacket(const DrawPacket& packet);
+
+	void drawBaseVertexBatch(int batch, GLenum primitiveType);
+
+	// pulls the instancable MeshCommands of the opaque 3d queue into groups and replaces every group with one command
+	void gatherMeshInstances(std::vector<RenderCommand*>& commands);
+	// groups the instancable commands of a run of MeshCommands, writes the remaining commands and the group draws to out and returns its end
+	std::vector<RenderCommand*>::iterator gatherMeshInstanceRun(std::vector<RenderCommand*>::iterator begin, std::vector<RenderCommand*>::iterator end, std::vector<RenderCommand*>::iterator out);
+	// the instanced variant of the program of the mesh, nullptr if it has none or cant be instanced
+	GLProgramState* getInstancedProgramState(MeshCommand* mesh);
+	void drawMeshInstances(int group);
+
 	// queue begin functions
 
 	void beginQueueTransparent();
@@ -270,38 +413,55 @@ protected:
 
 	inline int nextVBO() { return _vboIndex = (_vboIndex + 1) % _vboCount; }
 
+	// takes the slice size and vbo count from the buffer tuner, the gl buffers have to be deleted before
+	void resizeVBOs();
+	// feeds the buffer tuner with the stats of the frame and reallocates the buffers if needed
+	void tuneBuffers();
+	// grows the staging buffers in the middle of gathering if the memory budget allows it, the written part is kept.
+	// returns false if the usage exceeds the hard caps, the buffers are not large enough then
+	bool reserveArbitraryBuffers(ssize_t vertexBytes, ssize_t indexCount);
+	// reallocates the staging buffers to the capacities of the memory budget, only between frames
+	void resizeArbitraryBuffers();
+	// feeds the memory budget with the usage of the frame and shrinks the buffers if needed
+	void budgetBuffers();
+	// adds the counters of the frame to the memory stats, uploads are the differences of the draw stats over the frame
+	void recordMemoryStats(ssize_t uploadedBytes, ssize_t uploadCalls);
+
 	bool _isBufferSlicing;
 	bool _currentVBOIsWritten;
 
 	// pool and vector stuff
 
-	FastPool<ArbitraryVertexCommand*>* _avcPool1;
-	FastPool<ArbitraryVertexCommand*>* _avcPool2;
-
 	FastPool<CustomCommand*>* _customCommandPool1;
 	FastPool<CustomCommand*>* _customCommandPool2;
 
+	FastPool<QueueStateCommand*>* _queueStateCommandPool1;
+	FastPool<QueueStateCommand*>* _queueStateCommandPool2;
+
 	QueueCommand* _beginQueueTransparentCommand;
 	QueueCommand* _beginQueueOpaqueCommand;
 	QueueCommand* _beginQueue2dCommand;
 
-	FastVector<RenderCommand*>* _renderCommands;
+	// the flattened frame: batch draws and the commands between them in draw order
+	FastVector<DrawPacket>* _drawPackets;
+	// whether the buffers of a batch draw are still bound
+	bool _isDrawingBatches;
 
 	// arbitraryVertexCommand batching stuff
-	ArbitraryVertexCommand* _lastArbitraryCommand;
-
-	VertexBatch* _currentVertexBatch;
-	VertexBatch* _previousVertexBatch;
-
 	ssize_t _lastVertexBufferSlicePos;
 
 	int _currentVertexBatchIndex;
+	int _previousVertexBatchIndex;
 
 	// vbo data
 	// this value is used for a loose round-robin approach, may not be less than 1
 	float _vboCountMultiplier;
 	ssize_t _vboByteSlice;
 	unsigned int _vboCount;
+	RendererBufferTuner* _bufferTuner;
+	RendererMemoryBudget* _memoryBudget;
+	ssize_t _largestCommandVertexBytes;
+	long long _uploadNs;
 
 	// buffer data info
 	byte* _currentVertexBuffer;
@@ -311,17 +471,52 @@ protected:
 
 	// batching info
 	bool _lastMaterial_skipBatching = false;
-	bool _lastCommandWasIndexed;
 	bool _lastWasFlushCommand;
 	bool _firstAVC = false;
 	uint32_t _currentMaterial2dId;
+	const VertexFormat* _currentVertexFormat;
 
 	bool _lastAVC_was_NCT; // short version for : last ArbitaryVertexCommand was Non Cpu Transform
 	Mat4 _lastAVC_NCT_Matrix;
 
+	// matrix palettes: gpu transformed commands of a palette material share a batch, each batch uses a range of this list
+	FastVector<Mat4>* _paletteMatrices;
+
+	// scratch index data of the last strip, fan or loop command converted to a list
+	std::vector<GLushort> _listIndices;
+
 	// map buffer
 	bool _useMapBuffer;
 
+	// dirty range uploads: a vertex and an index tracker per vbo
+	bool _useDirtyRangeUploads;
+	BufferDirtyTracker* _vboDirtyTrackers;
+	std::vector<BufferRange> _dirtyRanges;
+
+	// base vertex drawing: indices are copied without rebasing, every indexed command becomes a sub draw with its own base vertex
+	bool _useBaseVertex;
+	FastVector<GLsizei>* _subDrawCounts;
+	FastVector<GLint>* _subDrawBaseVertices;
+	FastVector<ssize_t>* _subDrawFirstIndices; // relative to the index usage start of the batch
+	FastVector<GLvoid*>* _subDrawIndexOffsets; // scratch list for the multi draw call
+
+	// mesh instancing
+	struct MeshInstanceGroup {
+		GLProgramState* programState; // the instanced variant
+		int start; // into _meshInstanceCommands
+		int count;
+	};
+	bool _isMeshInstancingEnabled;
+	bool _meshInstancingSupported;
+	bool _useMeshInstanceColors;
+	std::unordered_map<GLProgram*, GLProgramState*> _instancedPrograms;
+	std::unordered_map<uint32_t, int> _meshInstanceCounts; // scratch, per material id
+	std::unordered_map<uint32_t, int> _meshInstanceGroupOfMaterial; // scratch
+	std::vector<MeshInstanceGroup> _meshInstanceGroups;
+	std::vector<MeshCommand*> _meshInstanceCommands;
+	std::vector<float> _meshInstanceData;
+	GLuint _meshInstanceVBO;
+
 	/* clear color set outside be used in setGLDefaultValues() */
 	Color4F _clearColor;
 
@@ -330,41 +525,72 @@ protected:
 	std::vector<RenderQueue> _renderGroups;
 
 	MeshCommand*              _lastBatchedMeshCommand;
-	std::vector<RenderCommand*> _batchedArbitaryCommands;
 
 	// for arbitaryDrawing
 	VertexIndexBO* _aBufferVBOs;
 	int _vboIndex;
 
-	byte _arbitraryVertexBuffer[ARBITRARY_VBO_SIZE];
-	unsigned short _arbitraryIndexBuffer[ARBITRARY_INDEX_VBO_SIZE];
-	FastVector<VertexBatch>* _vertexBatches;
-
-	int _currentAVCommandCount;
+	// staging buffers, sized by the memory budget
+	byte* _arbitraryVertexBuffer;
+	unsigned short* _arbitraryIndexBuffer;
+	ssize_t _arbitraryVertexCapacity; // in bytes
+	ssize_t _arbitraryIndexCapacity; // in indices
+	// the size of the storage last specified for every vbo, a vertex and an index entry per vbo
+	ssize_t* _vboBufferBytes;
+	VertexBatchList* _vertexBatches;
 
 	VertexAttribInfoFormat _triangleCommandVAIL;
 
-	int _currentDrawnVertexBatches;
-	int _currentDrawnRenderCommands;
-
-	int _startDrawIndex;
-
 	//for TrianglesCommand
 	int _filledVertex;
 	int _filledIndex;
 
 	//for QuadCommand
-	GLushort _quadIndices[INDEX_VBO_SIZE];
+	GLushort* _quadIndices;
 
 	bool _glViewAssigned;
+	bool _isHeadless;
+
+	RenderDevice* _device;
+	NullRenderDeviceBackend* _nullBackend;
 
 	// stats
 	ssize_t _drawnBatches;
 	ssize_t _drawnVertices;
+	ssize_t _uploadedBytes;
+	ssize_t _gatheredVertexBytes;
+	ssize_t _compactVertexBytesSaved;
+	ssize_t _skippedUploadBytes;
+	ssize_t _uploadCalls;
+	// vbos written in the current frame
+	int _usedVboSlices;
+	RendererMemoryStats* _memoryStats;
+	RendererProfiler* _profiler;
+	BatchBreakStats* _batchBreakStats;
 	//the flag for checking whether renderer is rendering
 	bool _isRendering;
 
 	bool _isDepthTestFor2D;
+	bool _isOpaque2DEnabled;
+	float _opaque2DNearZ;
+	float _opaque2DFarZ;
+	// cpu transformed 2d ArbitraryVertexCommands of the frame in submission order, they get their default depth 2d from it
+	std::vector<ArbitraryVertexCommand*> _depth2DCommands;
+
+	bool _isOcclusionCullingEnabled;
+	OcclusionCuller* _occlusionCuller;
+
+	// group merging
+	bool _isGroupMergingEnabled;
+	// whether the state is the one set by beginQueue2d, with no command gathered since then that could change it
+	bool _isIn2DState;
+	std::vector<signed char> _mergeableQueues; // per queue id: -1 unknown, 0 or 1
+	ssize_t _mergedGroups;
+
+	ssize_t _occludedCommands;
+	ssize_t _occludedVertices;
+
+	std::string _captureFramePath;
 
 	GroupCommandManager* _groupCommandManager;
 
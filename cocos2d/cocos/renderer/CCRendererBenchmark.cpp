@@ -0,0 +1,268 @@
+#include "renderer/CCRendererBenchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#include "renderer/CCRenderer.h"
+#include "renderer/CCGLProgram.h"
+#include "renderer/CCGLProgramState.h"
+#include "platform/CCFileUtils.h"
+
+NS_CC_BEGIN
+
+static unsigned short s_benchmarkQuadIndices[6] = { 0, 1, 2, 3, 2, 1 };
+
+RendererBenchmarkScene::RendererBenchmarkScene()
+	: name("scene")
+	, spriteCount(1000)
+	, materialCount(1)
+	, zSpread(0)
+	, groupDepth(0)
+	, transformOnCpu(true)
+	, compactVertexFormat(false)
+{
+}
+
+RendererBenchmark::RendererBenchmark(Renderer* renderer)
+	: _renderer(renderer)
+{
+	CCASSERT(renderer, "Invalid renderer");
+
+	if (renderer->isHeadless()) {
+		// a program that was never compiled, the headless renderer doesnt touch it
+		GLProgram* program = new (std::nothrow) GLProgram();
+		_programState = GLProgramState::create(program);
+		program->release();
+	}
+	else {
+		_programState = GLProgramState::getOrCreateWithGLProgramName(GLProgram::SHADER_NAME_POSITION_TEXTURE_COLOR_NO_MVP);
+	}
+	_programState->retain();
+}
+
+RendererBenchmark::~RendererBenchmark()
+{
+	_programState->release();
+}
+
+void RendererBenchmark::addScene(const RendererBenchmarkScene& scene)
+{
+	_scenes.push_back(scene);
+}
+
+void RendererBenchmark::addDefaultScenes()
+{
+	RendererBenchmarkScene scene;
+
+	const int spriteCounts[] = { 100, 1000, 10000 };
+	for (int count : spriteCounts) {
+		scene = RendererBenchmarkScene();
+		scene.name = "sprites_" + std::to_string(count);
+		scene.spriteCount = count;
+		addScene(scene);
+	}
+
+	const int materialCounts[] = { 4, 32 };
+	for (int count : materialCounts) {
+		scene = RendererBenchmarkScene();
+		scene.name = "materials_" + std::to_string(count);
+		scene.spriteCount = 5000;
+		scene.materialCount = count;
+		addScene(scene);
+	}
+
+	scene = RendererBenchmarkScene();
+	scene.name = "z_spread";
+	scene.spriteCount = 5000;
+	scene.materialCount = 4;
+	scene.zSpread = 100;
+	addScene(scene);
+
+	scene = RendererBenchmarkScene();
+	scene.name = "groups_nested";
+	scene.spriteCount = 5000;
+	scene.groupDepth = 8;
+	addScene(scene);
+
+	scene = RendererBenchmarkScene();
+	scene.name = "gpu_transform";
+	scene.spriteCount = 1000;
+	scene.transformOnCpu = false;
+	addScene(scene);
+
+	scene = RendererBenchmarkScene();
+	scene.name = "compact_format";
+	scene.spriteCount = 10000;
+	scene.compactVertexFormat = true;
+	addScene(scene);
+}
+
+void RendererBenchmark::generate(GeneratedScene& scene)
+{
+	const RendererBenchmarkScene& desc = scene.desc;
+
+	// fixed seed so every run renders exactly the same scene
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> position(0, 1024);
+	std::uniform_real_distribution<float> z(-desc.zSpread, desc.zSpread);
+	std::uniform_int_distribution<int> color(0, 255);
+
+	for (int i = 0; i < desc.materialCount; i++) {
+		Material2D* material = new Material2D();
+		GLuint texture = i + 1;
+		material->init(_programState, &texture, 1, BlendFunc::ALPHA_PREMULTIPLIED, *VertexStreamAttributes::getV3F_C4B_T2F(), MaterialPrimitiveType::TRIANGLE);
+		scene.materials.push_back(material);
+	}
+
+	for (int i = 0; i < desc.groupDepth; i++) {
+		GroupCommand* group = new GroupCommand();
+		group->init(0);
+		scene.groups.push_back(group);
+		scene.parentOfGroup.push_back(i - 1);
+	}
+
+	// the quads are in local space, the model view moves them
+	scene.quads.resize(desc.spriteCount);
+	for (int i = 0; i < desc.spriteCount; i++) {
+		V3F_C4B_T2F_Quad& quad = scene.quads[i];
+		Color4B c((GLubyte)color(random), (GLubyte)color(random), (GLubyte)color(random), 255);
+		quad.bl.vertices = Vec3(0, 0, 0);
+		quad.br.vertices = Vec3(32, 0, 0);
+		quad.tl.vertices = Vec3(0, 32, 0);
+		quad.tr.vertices = Vec3(32, 32, 0);
+		quad.bl.texCoords.u = 0; quad.bl.texCoords.v = 1;
+		quad.br.texCoords.u = 1; quad.br.texCoords.v = 1;
+		quad.tl.texCoords.u = 0; quad.tl.texCoords.v = 0;
+		quad.tr.texCoords.u = 1; quad.tr.texCoords.v = 0;
+		quad.bl.colors = quad.br.colors = quad.tl.colors = quad.tr.colors = c;
+	}
+
+	for (int i = 0; i < desc.spriteCount; i++) {
+		Mat4 mv = Mat4::IDENTITY;
+		mv.translate(position(random), position(random), 0);
+
+		ArbitraryVertexCommand::Data data;
+		data.vertexData = (byte*)&scene.quads[i];
+		data.vertexCount = 4;
+		data.indexData = s_benchmarkQuadIndices;
+		data.indexCount = 6;
+
+		ArbitraryVertexCommand* command = new ArbitraryVertexCommand();
+		float globalOrder = desc.zSpread != 0 ? z(random) : 0;
+		command->init(globalOrder, scene.materials[i % desc.materialCount], data, mv, desc.transformOnCpu, 0);
+		command->setCompactVertexFormat(desc.compactVertexFormat);
+		scene.commands.push_back(command);
+
+		// spread the sprites evenly over the default queue and the nested groups
+		scene.groupOfCommand.push_back((i % (desc.groupDepth + 1)) - 1);
+	}
+}
+
+void RendererBenchmark::release(GeneratedScene& scene)
+{
+	for (auto command : scene.commands) {
+		delete command;
+	}
+	for (auto group : scene.groups) {
+		delete group;
+	}
+	for (auto material : scene.materials) {
+		delete material;
+	}
+	scene.commands.clear();
+	scene.groups.clear();
+	scene.materials.clear();
+}
+
+void RendererBenchmark::submit(GeneratedScene& scene)
+{
+	for (size_t i = 0; i < scene.groups.size(); i++) {
+		int parent = scene.parentOfGroup[i];
+		_renderer->addCommand(scene.groups[i], parent < 0 ? 0 : scene.groups[parent]->getRenderQueueID());
+	}
+	for (size_t i = 0; i < scene.commands.size(); i++) {
+		int group = scene.groupOfCommand[i];
+		_renderer->addCommand(scene.commands[i], group < 0 ? 0 : scene.groups[group]->getRenderQueueID());
+	}
+}
+
+RendererBenchmarkFrame RendererBenchmark::renderFrame(GeneratedScene& scene)
+{
+	_renderer->clearDrawStats();
+	submit(scene);
+
+	auto start = std::chrono::steady_clock::now();
+	_renderer->render();
+	auto end = std::chrono::steady_clock::now();
+
+	RendererBenchmarkFrame frame;
+	frame.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+	frame.draws = _renderer->getDrawnBatches();
+	frame.vertices = _renderer->getDrawnVertices();
+	frame.uploadedBytes = _renderer->getUploadedBytes();
+	return frame;
+}
+
+std::string RendererBenchmark::run(int warmupFrames, int frameCount)
+{
+	std::string json = "{\"scenes\":[";
+	char buffer[512];
+
+	for (size_t s = 0; s < _scenes.size(); s++) {
+		GeneratedScene scene;
+		scene.desc = _scenes[s];
+		generate(scene);
+
+		for (int i = 0; i < warmupFrames; i++) {
+			renderFrame(scene);
+		}
+
+		std::vector<RendererBenchmarkFrame> frames;
+		frames.reserve(frameCount);
+		for (int i = 0; i < frameCount; i++) {
+			frames.push_back(renderFrame(scene));
+		}
+
+		release(scene);
+
+		std::vector<long long> sorted;
+		long long total = 0;
+		for (auto& frame : frames) {
+			sorted.push_back(frame.ns);
+			total += frame.ns;
+		}
+		std::sort(sorted.begin(), sorted.end());
+
+		const RendererBenchmarkScene& desc = scene.desc;
+		snprintf(buffer, sizeof(buffer),
+			"%s{\"name\":\"%s\",\"sprites\":%d,\"materials\":%d,\"zSpread\":%g,\"groupDepth\":%d,\"transformOnCpu\":%s,\"compactVertexFormat\":%s,",
+			s > 0 ? "," : "", desc.name.c_str(), desc.spriteCount, desc.materialCount, desc.zSpread, desc.groupDepth,
+			desc.transformOnCpu ? "true" : "false", desc.compactVertexFormat ? "true" : "false");
+		json += buffer;
+
+		if (frameCount > 0) {
+			snprintf(buffer, sizeof(buffer), "\"minNs\":%lld,\"medianNs\":%lld,\"avgNs\":%lld,\"maxNs\":%lld,",
+				sorted.front(), sorted[sorted.size() / 2], total / frameCount, sorted.back());
+			json += buffer;
+		}
+
+		json += "\"frames\":[";
+		for (size_t i = 0; i < frames.size(); i++) {
+			snprintf(buffer, sizeof(buffer), "%s{\"ns\":%lld,\"draws\":%zd,\"vertices\":%zd,\"uploadedBytes\":%zd}",
+				i > 0 ? "," : "", frames[i].ns, frames[i].draws, frames[i].vertices, frames[i].uploadedBytes);
+			json += buffer;
+		}
+		json += "]}";
+	}
+
+	json += "]}";
+	return json;
+}
+
+bool RendererBenchmark::runToFile(const std::string& path, int warmupFrames, int frameCount)
+{
+	return FileUtils::getInstance()->writeStringToFile(run(warmupFrames, frameCount), path);
+}
+
+NS_CC_END
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "platform/CCPlatformMacros.h"
+#include "renderer/CCArbitraryVertexCommand.h"
+#include "renderer/CCGroupCommand.h"
+
+NS_CC_BEGIN
+
+class Renderer;
+
+// describes one synthetic scene the benchmark renders
+struct CC_DLL RendererBenchmarkScene {
+	std::string name;
+	// the number of sprites (quads) in the scene
+	int spriteCount;
+	// the number of different materials, the sprites cycle through them
+	int materialCount;
+	// 0 puts every sprite at global z 0, otherwise the global z is random within -zSpread..zSpread
+	float zSpread;
+	// the sprites are distributed over nested GroupCommands of this depth. 0 means no groups
+	int groupDepth;
+	// whether the sprites are transformed on the cpu or by the shader
+	bool transformOnCpu;
+	// whether the sprites use the compact vertex format
+	bool compactVertexFormat;
+
+	RendererBenchmarkScene();
+};
+
+// stats of a single benchmarked frame
+struct CC_DLL RendererBenchmarkFrame {
+	long long ns;
+	ssize_t draws;
+	ssize_t vertices;
+	ssize_t uploadedBytes;
+};
+
+/* Renders synthetic scenes through the real Renderer::render and reports the time, draw calls and uploaded bytes of every frame as json.
+The renderer should be initialized with Renderer::initHeadless to run without a gpu.
+GroupCommands register themselves with the director's renderer, so scenes with groupDepth > 0 must use that renderer. */
+class CC_DLL RendererBenchmark {
+public:
+	RendererBenchmark(Renderer* renderer);
+	~RendererBenchmark();
+
+	void addScene(const RendererBenchmarkScene& scene);
+	// adds a set of scenes covering sprite count, material count, z distribution, group nesting, transform mode and vertex format
+	void addDefaultScenes();
+
+	// renders every scene warmupFrames times unmeasured and frameCount times measured, returns the results as json
+	std::string run(int warmupFrames, int frameCount);
+	// same as run but writes the json to the given file, returns false if the file could not be written
+	bool runToFile(const std::string& path, int warmupFrames, int frameCount);
+
+protected:
+	struct GeneratedScene {
+		RendererBenchmarkScene desc;
+		std::vector<Material2D*> materials;
+		std::vector<ArbitraryVertexCommand*> commands;
+		std::vector<GroupCommand*> groups;
+		std::vector<int> groupOfCommand; // -1 for the default render queue
+		std::vector<int> parentOfGroup; // -1 for the default render queue
+		std::vector<V3F_C4B_T2F_Quad> quads;
+	};
+
+	void generate(GeneratedScene& scene);
+	void release(GeneratedScene& scene);
+	void submit(GeneratedScene& scene);
+	RendererBenchmarkFrame renderFrame(GeneratedScene& scene);
+
+	Renderer* _renderer;
+	GLProgramState* _programState;
+	std::vector<RendererBenchmarkScene> _scenes;
+};
+
+NS_CC_END
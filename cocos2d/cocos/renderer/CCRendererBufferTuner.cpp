@@ -0,0 +1,147 @@
+#include "renderer/CCRendererBufferTuner.h"
+
+#include <algorithm>
+#include <math.h>
+
+#include "base/ccMacros.h"
+#include "platform/CCFileUtils.h"
+#include "renderer/CCRenderer.h"
+
+NS_CC_BEGIN
+
+RendererBufferTunerConfig::RendererBufferTunerConfig()
+	: adaptive(false)
+	, sliceSize(100000)
+	, minSliceSize(32768)
+	, maxSliceSize(ARBITRARY_VBO_SIZE)
+	, vboCount(0)
+	, minVboCount(2)
+	, maxVboCount(64)
+	, vboCountMultiplier(1.3f)
+	, evaluationFrames(60)
+	, maxSliceBreaksPerFrame(4)
+	, uploadBudgetNs(2000000)
+{
+}
+
+RendererBufferTuner::RendererBufferTuner()
+{
+	setConfig(RendererBufferTunerConfig());
+}
+
+bool RendererBufferTuner::loadConfig(const std::string& path)
+{
+	if (!FileUtils::getInstance()->isFileExist(path)) {
+		return false;
+	}
+	ValueMap values = FileUtils::getInstance()->getValueMapFromFile(path);
+	if (values.empty()) {
+		return false;
+	}
+
+	RendererBufferTunerConfig config = _config;
+	auto read = [&values](const char* key) -> const Value* {
+		auto it = values.find(key);
+		return it != values.end() ? &it->second : nullptr;
+	};
+	const Value* value;
+	if ((value = read("renderer.vbo.adaptive"))) config.adaptive = value->asBool();
+	if ((value = read("renderer.vbo.slice"))) config.sliceSize = value->asInt();
+	if ((value = read("renderer.vbo.minSlice"))) config.minSliceSize = value->asInt();
+	if ((value = read("renderer.vbo.maxSlice"))) config.maxSliceSize = value->asInt();
+	if ((value = read("renderer.vbo.count"))) config.vboCount = value->asInt();
+	if ((value = read("renderer.vbo.minCount"))) config.minVboCount = value->asInt();
+	if ((value = read("renderer.vbo.maxCount"))) config.maxVboCount = value->asInt();
+	if ((value = read("renderer.vbo.countMultiplier"))) config.vboCountMultiplier = value->asFloat();
+	if ((value = read("renderer.vbo.evaluationFrames"))) config.evaluationFrames = value->asInt();
+	if ((value = read("renderer.vbo.maxSliceBreaks"))) config.maxSliceBreaksPerFrame = value->asFloat();
+	if ((value = read("renderer.vbo.uploadBudgetUs"))) config.uploadBudgetNs = (long long)value->asInt() * 1000;
+
+	setConfig(config);
+	return true;
+}
+
+void RendererBufferTuner::setConfig(const RendererBufferTunerConfig& config)
+{
+	CCASSERT(config.minSliceSize > 0 && config.minSliceSize <= config.maxSliceSize && config.maxSliceSize <= ARBITRARY_VBO_SIZE, "Invalid slice size bounds");
+	CCASSERT(config.minVboCount > 0 && config.minVboCount <= config.maxVboCount, "Invalid vbo count bounds");
+	CCASSERT(config.vboCountMultiplier >= 1, "The vbo count multiplier may not be less than 1");
+
+	_config = config;
+	_sliceSize = std::min(std::max(config.sliceSize, config.minSliceSize), config.maxSliceSize);
+	if (config.vboCount > 0) {
+		_vboCount = std::min(std::max(config.vboCount, config.minVboCount), config.maxVboCount);
+	}
+	else {
+		// enough slices for completely filled buffers
+		_vboCount = std::min(std::max((unsigned int)ceilf(ARBITRARY_VBO_SIZE / (float)_sliceSize), config.minVboCount), config.maxVboCount);
+	}
+	_changed = true;
+	reset();
+}
+
+void RendererBufferTuner::reset()
+{
+	_frames = 0;
+	_peakGatheredBytes = 0;
+	_largestCommandBytes = 0;
+	_sliceBreaks = 0;
+	_uploadNs = 0;
+}
+
+unsigned int RendererBufferTuner::computeVboCount(ssize_t frameBytes) const
+{
+	unsigned int slices = (unsigned int)ceilf(frameBytes / (float)_sliceSize);
+	unsigned int count = (unsigned int)ceilf(std::max(slices, 1u) * _config.vboCountMultiplier);
+	return std::min(std::max(count, _config.minVboCount), _config.maxVboCount);
+}
+
+void RendererBufferTuner::addFrame(ssize_t gatheredBytes, ssize_t largestCommandBytes, int sliceBreaks, long long uploadNs)
+{
+	if (!_config.adaptive) {
+		return;
+	}
+
+	_frames++;
+	_peakGatheredBytes = std::max(_peakGatheredBytes, gatheredBytes);
+	_largestCommandBytes = std::max(_largestCommandBytes, largestCommandBytes);
+	_sliceBreaks += sliceBreaks;
+	_uploadNs += uploadNs;
+
+	if (_frames < _config.evaluationFrames) {
+		return;
+	}
+
+	float sliceBreaksPerFrame = _sliceBreaks / (float)_frames;
+	long long uploadNsPerFrame = _uploadNs / _frames;
+
+	ssize_t sliceSize = _sliceSize;
+	if (sliceBreaksPerFrame > _config.maxSliceBreaksPerFrame) {
+		// too many draws are split by full slices
+		sliceSize = std::min(sliceSize * 2, _config.maxSliceSize);
+	}
+	else if (uploadNsPerFrame > _config.uploadBudgetNs) {
+		sliceSize = std::max(sliceSize / 2, _config.minSliceSize);
+	}
+
+	// a single command has to fit into a slice
+	if (sliceSize <= _largestCommandBytes) {
+		sliceSize = std::max(_sliceSize, sliceSize);
+	}
+
+	if (sliceSize != _sliceSize) {
+		_sliceSize = sliceSize;
+		_changed = true;
+	}
+
+	// deep enough to cycle through the biggest frame of the window
+	unsigned int vboCount = computeVboCount(_peakGatheredBytes);
+	if (vboCount != _vboCount) {
+		_vboCount = vboCount;
+		_changed = true;
+	}
+
+	reset();
+}
+
+NS_CC_END
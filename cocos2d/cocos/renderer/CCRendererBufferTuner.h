@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+
+#include "platform/CCPlatformMacros.h"
+
+NS_CC_BEGIN
+
+struct CC_DLL RendererBufferTunerConfig {
+	// whether the slice size and vbo count are adjusted at runtime. if false the initial values are used
+	bool adaptive;
+
+	ssize_t sliceSize; // initial slice size in bytes
+	ssize_t minSliceSize;
+	ssize_t maxSliceSize;
+
+	unsigned int vboCount; // initial vbo count, 0 derives it from the slice size
+	unsigned int minVboCount;
+	unsigned int maxVboCount;
+	// the vbo count is the number of slices of the biggest frame times this value, used for a loose round-robin approach. may not be less than 1
+	float vboCountMultiplier;
+
+	// the number of frames averaged before the values are adjusted
+	int evaluationFrames;
+	// grow the slices if more batch breaks per frame than this are caused by full slices
+	float maxSliceBreaksPerFrame;
+	// shrink the slices if uploading takes longer than this per frame, big orphaned buffers tend to stall the driver
+	long long uploadBudgetNs;
+
+	RendererBufferTunerConfig();
+};
+
+/* Adjusts the vbo slice size and the number of vbos the renderer cycles through from the stats of the last frames.
+The renderer feeds it once per frame and only reallocates its buffers at the end of a frame when hasChanged() is set */
+class CC_DLL RendererBufferTuner {
+public:
+	RendererBufferTuner();
+
+	/* Loads an override of the config from a plist file. Known keys:
+	renderer.vbo.adaptive, renderer.vbo.slice, renderer.vbo.minSlice, renderer.vbo.maxSlice,
+	renderer.vbo.count, renderer.vbo.minCount, renderer.vbo.maxCount, renderer.vbo.countMultiplier,
+	renderer.vbo.evaluationFrames, renderer.vbo.maxSliceBreaks, renderer.vbo.uploadBudgetUs.
+	Missing keys keep their current value. Returns false if the file could not be read */
+	bool loadConfig(const std::string& path);
+	void setConfig(const RendererBufferTunerConfig& config);
+	const RendererBufferTunerConfig& getConfig() const { return _config; }
+
+	// called by the renderer at the end of every frame
+	void addFrame(ssize_t gatheredBytes, ssize_t largestCommandBytes, int sliceBreaks, long long uploadNs);
+
+	ssize_t getSliceSize() const { return _sliceSize; }
+	unsigned int getVboCount() const { return _vboCount; }
+
+	// whether the slice size or vbo count changed since the last call of clearChanged
+	bool hasChanged() const { return _changed; }
+	void clearChanged() { _changed = false; }
+
+protected:
+	void reset();
+	unsigned int computeVboCount(ssize_t frameBytes) const;
+
+	RendererBufferTunerConfig _config;
+
+	ssize_t _sliceSize;
+	unsigned int _vboCount;
+	bool _changed;
+
+	// stats of the current evaluation window
+	int _frames;
+	ssize_t _peakGatheredBytes;
+	ssize_t _largestCommandBytes;
+	long long _sliceBreaks;
+	long long _uploadNs;
+};
+
+NS_CC_END
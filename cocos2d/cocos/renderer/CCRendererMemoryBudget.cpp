@@ -0,0 +1,136 @@
+#include "renderer/CCRendererMemoryBudget.h"
+
+#include <algorithm>
+#include <math.h>
+
+#include "base/ccMacros.h"
+#include "platform/CCFileUtils.h"
+#include "renderer/CCRenderer.h"
+
+NS_CC_BEGIN
+
+RendererMemoryBudgetConfig::RendererMemoryBudgetConfig()
+	: enabled(false)
+	, initialVertexBytes(128 * 1024)
+	, initialIndexCount(16 * 1024)
+	, maxVertexBytes(ARBITRARY_VBO_SIZE)
+	, maxIndexCount(ARBITRARY_INDEX_VBO_SIZE)
+	, growthFactor(1.5f)
+	, shrinkThreshold(0.5f)
+	, shrinkFrames(300)
+{
+}
+
+RendererMemoryBudget::RendererMemoryBudget()
+{
+	setConfig(RendererMemoryBudgetConfig());
+}
+
+bool RendererMemoryBudget::loadConfig(const std::string& path)
+{
+	if (!FileUtils::getInstance()->isFileExist(path)) {
+		return false;
+	}
+	ValueMap values = FileUtils::getInstance()->getValueMapFromFile(path);
+	if (values.empty()) {
+		return false;
+	}
+
+	RendererMemoryBudgetConfig config = _config;
+	auto read = [&values](const char* key) -> const Value* {
+		auto it = values.find(key);
+		return it != values.end() ? &it->second : nullptr;
+	};
+	const Value* value;
+	if ((value = read("renderer.memory.enabled"))) config.enabled = value->asBool();
+	if ((value = read("renderer.memory.initialVertexBytes"))) config.initialVertexBytes = value->asInt();
+	if ((value = read("renderer.memory.initialIndices"))) config.initialIndexCount = value->asInt();
+	if ((value = read("renderer.memory.maxVertexBytes"))) config.maxVertexBytes = value->asInt();
+	if ((value = read("renderer.memory.maxIndices"))) config.maxIndexCount = value->asInt();
+	if ((value = read("renderer.memory.growthFactor"))) config.growthFactor = value->asFloat();
+	if ((value = read("renderer.memory.shrinkThreshold"))) config.shrinkThreshold = value->asFloat();
+	if ((value = read("renderer.memory.shrinkFrames"))) config.shrinkFrames = value->asInt();
+
+	setConfig(config);
+	return true;
+}
+
+void RendererMemoryBudget::setConfig(const RendererMemoryBudgetConfig& config)
+{
+	CCASSERT(config.initialVertexBytes > 0 && config.initialVertexBytes <= config.maxVertexBytes && config.maxVertexBytes <= ARBITRARY_VBO_SIZE, "Invalid vertex buffer bounds");
+	CCASSERT(config.initialIndexCount > 0 && config.initialIndexCount <= config.maxIndexCount && config.maxIndexCount <= ARBITRARY_INDEX_VBO_SIZE, "Invalid index buffer bounds");
+	CCASSERT(config.growthFactor >= 1, "The growth factor may not be less than 1");
+	CCASSERT(config.shrinkThreshold > 0 && config.shrinkThreshold <= 1 && config.shrinkFrames > 0, "Invalid shrink settings");
+
+	_config = config;
+	if (config.enabled) {
+		_vertexCapacity = config.initialVertexBytes;
+		_indexCapacity = config.initialIndexCount;
+	}
+	else {
+		_vertexCapacity = config.maxVertexBytes;
+		_indexCapacity = config.maxIndexCount;
+	}
+	_changed = true;
+
+	_quietVertexFrames = _quietIndexFrames = 0;
+	_peakVertexBytes = _peakIndexCount = 0;
+}
+
+ssize_t RendererMemoryBudget::grownCapacity(ssize_t needed, ssize_t initial, ssize_t max) const
+{
+	ssize_t capacity = (ssize_t)ceilf(needed * _config.growthFactor);
+	return std::min(std::max(capacity, initial), max);
+}
+
+bool RendererMemoryBudget::grow(ssize_t vertexBytes, ssize_t indexCount)
+{
+	if (vertexBytes > _vertexCapacity) {
+		_vertexCapacity = grownCapacity(vertexBytes, _config.initialVertexBytes, _config.maxVertexBytes);
+		_quietVertexFrames = 0;
+		_peakVertexBytes = 0;
+		_changed = true;
+	}
+	if (indexCount > _indexCapacity) {
+		_indexCapacity = grownCapacity(indexCount, _config.initialIndexCount, _config.maxIndexCount);
+		_quietIndexFrames = 0;
+		_peakIndexCount = 0;
+		_changed = true;
+	}
+	return vertexBytes <= _vertexCapacity && indexCount <= _indexCapacity;
+}
+
+void RendererMemoryBudget::trackUsage(ssize_t used, ssize_t& capacity, int& quietFrames, ssize_t& peak, ssize_t initial, ssize_t max)
+{
+	if (used >= capacity * _config.shrinkThreshold) {
+		quietFrames = 0;
+		peak = 0;
+		return;
+	}
+
+	quietFrames++;
+	peak = std::max(peak, used);
+	if (quietFrames < _config.shrinkFrames) {
+		return;
+	}
+
+	ssize_t shrunk = grownCapacity(peak, initial, max);
+	if (shrunk < capacity) {
+		capacity = shrunk;
+		_changed = true;
+	}
+	quietFrames = 0;
+	peak = 0;
+}
+
+void RendererMemoryBudget::addFrame(ssize_t vertexBytes, ssize_t indexCount)
+{
+	if (!_config.enabled) {
+		return;
+	}
+
+	trackUsage(vertexBytes, _vertexCapacity, _quietVertexFrames, _peakVertexBytes, _config.initialVertexBytes, _config.maxVertexBytes);
+	trackUsage(indexCount, _indexCapacity, _quietIndexFrames, _peakIndexCount, _config.initialIndexCount, _config.maxIndexCount);
+}
+
+NS_CC_END
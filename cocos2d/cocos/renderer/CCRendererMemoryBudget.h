@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+
+#include "platform/CCPlatformMacros.h"
+
+NS_CC_BEGIN
+
+struct CC_DLL RendererMemoryBudgetConfig {
+	// whether the vertex and index buffers grow and shrink with the usage. if false they have the maximum size from the start
+	bool enabled;
+
+	ssize_t initialVertexBytes;
+	ssize_t initialIndexCount;
+	// hard caps, the commands of a frame that dont fit anymore are dropped like without a budget. may not exceed ARBITRARY_VBO_SIZE and ARBITRARY_INDEX_VBO_SIZE
+	ssize_t maxVertexBytes;
+	ssize_t maxIndexCount;
+
+	// a buffer that is too small grows to the needed size times this value. may not be less than 1
+	float growthFactor;
+	// a buffer shrinks after shrinkFrames frames in a row used less than this fraction of it, to the peak of those frames times growthFactor
+	float shrinkThreshold;
+	int shrinkFrames;
+
+	RendererMemoryBudgetConfig();
+};
+
+/* Decides the capacities of the cpu staging buffers and the gl buffers the renderer gathers ArbitraryVertexCommands into.
+Buffers grow as soon as a frame needs more, even in the middle of gathering, and shrink back after a quiet period.
+The renderer feeds it once per frame and only shrinks its buffers at the end of a frame when hasChanged() is set */
+class CC_DLL RendererMemoryBudget {
+public:
+	RendererMemoryBudget();
+
+	/* Loads an override of the config from a plist file. Known keys:
+	renderer.memory.enabled, renderer.memory.initialVertexBytes, renderer.memory.initialIndices,
+	renderer.memory.maxVertexBytes, renderer.memory.maxIndices, renderer.memory.growthFactor,
+	renderer.memory.shrinkThreshold, renderer.memory.shrinkFrames.
+	Missing keys keep their current value. Returns false if the file could not be read */
+	bool loadConfig(const std::string& path);
+	void setConfig(const RendererMemoryBudgetConfig& config);
+	const RendererMemoryBudgetConfig& getConfig() const { return _config; }
+	bool isEnabled() const { return _config.enabled; }
+
+	/* Called by the renderer when a command doesnt fit anymore. Raises the capacities to hold the given usage plus the growth
+	and returns false if the usage exceeds the caps */
+	bool grow(ssize_t vertexBytes, ssize_t indexCount);
+
+	// called by the renderer at the end of every frame with the used part of the buffers
+	void addFrame(ssize_t vertexBytes, ssize_t indexCount);
+
+	ssize_t getVertexCapacity() const { return _vertexCapacity; }
+	ssize_t getIndexCapacity() const { return _indexCapacity; }
+
+	// whether the capacities changed since the last call of clearChanged
+	bool hasChanged() const { return _changed; }
+	void clearChanged() { _changed = false; }
+
+protected:
+	// needed times the growth factor, clamped to [initial, max]
+	ssize_t grownCapacity(ssize_t needed, ssize_t initial, ssize_t max) const;
+	// counts the quiet frames of one buffer and shrinks it at the end of a quiet period
+	void trackUsage(ssize_t used, ssize_t& capacity, int& quietFrames, ssize_t& peak, ssize_t initial, ssize_t max);
+
+	RendererMemoryBudgetConfig _config;
+
+	ssize_t _vertexCapacity;
+	ssize_t _indexCapacity;
+	bool _changed;
+
+	// stats of the current quiet period of each buffer
+	int _quietVertexFrames;
+	int _quietIndexFrames;
+	ssize_t _peakVertexBytes;
+	ssize_t _peakIndexCount;
+};
+
+NS_CC_END
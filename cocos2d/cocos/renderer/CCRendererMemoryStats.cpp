@@ -0,0 +1,116 @@
+#include "renderer/CCRendererMemoryStats.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#include "base/ccMacros.h"
+
+NS_CC_BEGIN
+
+static const char* s_counterNames[RENDERER_MEMORY_COUNTER_COUNT] = {
+	"gathered_vertex_bytes",
+	"gathered_index_bytes",
+	"uploaded_bytes",
+	"upload_calls",
+	"vbo_slices",
+	"vbo_count",
+	"vertex_buffer_occupancy",
+	"index_buffer_occupancy",
+	"custom_command_pool_peak",
+	"queue_state_pool_peak",
+	"vertex_batches",
+};
+
+RendererMemoryStats::RendererMemoryStats(int capacity)
+	: _frames(nullptr)
+	, _capacity(0)
+	, _count(0)
+	, _next(0)
+{
+	setCapacity(capacity);
+}
+
+RendererMemoryStats::~RendererMemoryStats()
+{
+	delete[] _frames;
+}
+
+void RendererMemoryStats::setCapacity(int capacity)
+{
+	CCASSERT(capacity > 0, "Invalid capacity");
+	delete[] _frames;
+	_frames = new RendererMemoryFrame[capacity];
+	_capacity = capacity;
+	clear();
+}
+
+void RendererMemoryStats::clear()
+{
+	_count = 0;
+	_next = 0;
+}
+
+const RendererMemoryFrame& RendererMemoryStats::getFrame(int index) const
+{
+	CCASSERT(index >= 0 && index < _count, "Invalid frame index");
+	int oldest = _count < _capacity ? 0 : _next;
+	return _frames[(oldest + index) % _capacity];
+}
+
+void RendererMemoryStats::addFrame(const RendererMemoryFrame& frame)
+{
+	_frames[_next] = frame;
+	_next = (_next + 1) % _capacity;
+	if (_count < _capacity) {
+		_count++;
+	}
+}
+
+RendererMemoryRange RendererMemoryStats::getRange(RendererMemoryCounter counter) const
+{
+	RendererMemoryRange range = { 0, 0, 0 };
+	if (_count == 0) {
+		return range;
+	}
+
+	// the order of the frames doesnt matter here, so the ring is walked as it is stored
+	long long sum = 0;
+	range.min = range.max = _frames[0].values[counter];
+	for (int i = 0; i < _count; i++) {
+		long long value = _frames[i].values[counter];
+		range.min = std::min(range.min, value);
+		range.max = std::max(range.max, value);
+		sum += value;
+	}
+	range.avg = sum / (double)_count;
+	return range;
+}
+
+long long RendererMemoryStats::getLatest(RendererMemoryCounter counter) const
+{
+	return _count > 0 ? getFrame(_count - 1).values[counter] : 0;
+}
+
+std::string RendererMemoryStats::dump() const
+{
+	std::string result;
+	char buffer[160];
+
+	snprintf(buffer, sizeof(buffer), "renderer memory over %d frames (latest, min, avg, max):\n", _count);
+	result += buffer;
+	for (int i = 0; i < RENDERER_MEMORY_COUNTER_COUNT; i++) {
+		RendererMemoryCounter counter = (RendererMemoryCounter)i;
+		RendererMemoryRange range = getRange(counter);
+		snprintf(buffer, sizeof(buffer), "  %s: %lld, %lld, %.1f, %lld\n", s_counterNames[i], getLatest(counter), range.min, range.avg, range.max);
+		result += buffer;
+	}
+	return result;
+}
+
+const char* RendererMemoryStats::getCounterName(RendererMemoryCounter counter)
+{
+	return s_counterNames[counter];
+}
+
+NS_CC_END
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+
+#include "platform/CCPlatformMacros.h"
+
+NS_CC_BEGIN
+
+// the per frame memory and bandwidth counters of the renderer
+enum RendererMemoryCounter {
+	RENDERER_MEMORY_GATHERED_VERTEX_BYTES, // written into the staging vertex buffer
+	RENDERER_MEMORY_GATHERED_INDEX_BYTES, // written into the staging index buffer
+	RENDERER_MEMORY_UPLOADED_BYTES, // passed to glBufferData and glBufferSubData
+	RENDERER_MEMORY_UPLOAD_CALLS, // glBufferData and glBufferSubData calls with data
+	RENDERER_MEMORY_VBO_SLICES, // vbos written this frame
+	RENDERER_MEMORY_VBO_COUNT, // vbos the slices cycle through
+	RENDERER_MEMORY_VERTEX_BUFFER_OCCUPANCY, // used percent of the staging vertex buffer
+	RENDERER_MEMORY_INDEX_BUFFER_OCCUPANCY, // used percent of the staging index buffer
+	RENDERER_MEMORY_CUSTOM_COMMAND_POOL_PEAK, // pooled custom commands in use at the end of the frame, its peak
+	RENDERER_MEMORY_QUEUE_STATE_POOL_PEAK, // pooled queue state commands in use at the end of the frame, its peak
+	RENDERER_MEMORY_VERTEX_BATCHES,
+	RENDERER_MEMORY_COUNTER_COUNT
+};
+
+struct CC_DLL RendererMemoryFrame {
+	long long values[RENDERER_MEMORY_COUNTER_COUNT];
+};
+
+struct CC_DLL RendererMemoryRange {
+	long long min;
+	double avg;
+	long long max;
+};
+
+/* Keeps the memory and bandwidth counters of the last frames of a renderer in a ring buffer.
+The ranges are computed over the frames currently in the ring, so they roll with it */
+class CC_DLL RendererMemoryStats {
+public:
+	RendererMemoryStats(int capacity = 240);
+	~RendererMemoryStats();
+
+	// drops all recorded frames and reallocates the ring
+	void setCapacity(int capacity);
+	int getCapacity() const { return _capacity; }
+	// the number of frames in the ring, at most the capacity
+	int getFrameCount() const { return _count; }
+	// 0 is the oldest frame in the ring, getFrameCount() - 1 the latest
+	const RendererMemoryFrame& getFrame(int index) const;
+	void clear();
+
+	// called by the renderer at the end of every frame
+	void addFrame(const RendererMemoryFrame& frame);
+
+	// min, average and max of the counter over the frames in the ring, all 0 if the ring is empty
+	RendererMemoryRange getRange(RendererMemoryCounter counter) const;
+	// the counter of the latest frame
+	long long getLatest(RendererMemoryCounter counter) const;
+
+	// a human readable table of the latest value and the range of every counter
+	std::string dump() const;
+
+	static const char* getCounterName(RendererMemoryCounter counter);
+
+protected:
+	RendererMemoryFrame* _frames;
+	int _capacity;
+	int _count;
+	int _next;
+};
+
+NS_CC_END
@@ -0,0 +1,133 @@
+#include "renderer/CCRendererProfiler.h"
+
+#include <algorithm>
+#include <vector>
+#include <string.h>
+
+#include "base/ccMacros.h"
+#include "platform/CCFileUtils.h"
+
+NS_CC_BEGIN
+
+static const char* s_phaseNames[RENDERER_PHASE_COUNT + 1] = { "sort", "gather", "map_buffers", "draw", "frame" };
+
+RendererProfiler::RendererProfiler(int capacity)
+	: _frames(nullptr)
+	, _capacity(0)
+	, _count(0)
+	, _next(0)
+{
+	_epoch = std::chrono::steady_clock::now();
+	memset(&_current, 0, sizeof(RendererFrameStats));
+	setCapacity(capacity);
+}
+
+RendererProfiler::~RendererProfiler()
+{
+	delete[] _frames;
+}
+
+void RendererProfiler::setCapacity(int capacity)
+{
+	CCASSERT(capacity > 0, "Invalid capacity");
+	delete[] _frames;
+	_frames = new RendererFrameStats[capacity];
+	_capacity = capacity;
+	clear();
+}
+
+void RendererProfiler::clear()
+{
+	_count = 0;
+	_next = 0;
+}
+
+const RendererFrameStats& RendererProfiler::getFrame(int index) const
+{
+	CCASSERT(index >= 0 && index < _count, "Invalid frame index");
+	int oldest = _count < _capacity ? 0 : _next;
+	return _frames[(oldest + index) % _capacity];
+}
+
+void RendererProfiler::beginFrame(ssize_t drawnBatches, ssize_t drawnVertices)
+{
+	memset(&_current, 0, sizeof(RendererFrameStats));
+	// the draw stats of the renderer are only reset by clearDrawStats, so store the counts at the start and keep the difference
+	_current.drawnBatches = drawnBatches;
+	_current.drawnVertices = drawnVertices;
+	_current.frameStart = now();
+}
+
+void RendererProfiler::endFrame(ssize_t drawnBatches, ssize_t drawnVertices)
+{
+	_current.frameTime = now() - _current.frameStart;
+	_current.drawnBatches = drawnBatches - _current.drawnBatches;
+	_current.drawnVertices = drawnVertices - _current.drawnVertices;
+
+	_frames[_next] = _current;
+	_next = (_next + 1) % _capacity;
+	if (_count < _capacity) {
+		_count++;
+	}
+}
+
+long long RendererProfiler::getPercentile(RendererPhase phase, float percentile) const
+{
+	if (_count == 0) {
+		return 0;
+	}
+
+	std::vector<long long> times;
+	times.reserve(_count);
+	for (int i = 0; i < _count; i++) {
+		times.push_back(phase == RENDERER_PHASE_COUNT ? _frames[i].frameTime : _frames[i].phaseTime[phase]);
+	}
+
+	// nearest rank
+	int rank = (int)(percentile / 100.0f * _count + 0.5f);
+	rank = std::min(std::max(rank, 1), _count) - 1;
+	std::nth_element(times.begin(), times.begin() + rank, times.end());
+	return times[rank];
+}
+
+std::string RendererProfiler::toChromeTrace() const
+{
+	// trace event timestamps and durations are in microseconds
+	std::string json = "{\"traceEvents\":[";
+	char buffer[256];
+	bool first = true;
+
+	for (int i = 0; i < _count; i++) {
+		const RendererFrameStats& frame = getFrame(i);
+
+		snprintf(buffer, sizeof(buffer),
+			"%s{\"name\":\"frame\",\"cat\":\"renderer\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"batches\":%zd,\"vertices\":%zd}}",
+			first ? "" : ",", frame.frameStart / 1000.0, frame.frameTime / 1000.0, frame.drawnBatches, frame.drawnVertices);
+		json += buffer;
+		first = false;
+
+		for (int p = 0; p < RENDERER_PHASE_COUNT; p++) {
+			if (frame.phaseTime[p] == 0) {
+				continue;
+			}
+			snprintf(buffer, sizeof(buffer), ",{\"name\":\"%s\",\"cat\":\"renderer\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+				s_phaseNames[p], frame.phaseStart[p] / 1000.0, frame.phaseTime[p] / 1000.0);
+			json += buffer;
+		}
+	}
+
+	json += "],\"displayTimeUnit\":\"ns\"}";
+	return json;
+}
+
+bool RendererProfiler::exportChromeTrace(const std::string& path) const
+{
+	return FileUtils::getInstance()->writeStringToFile(toChromeTrace(), path);
+}
+
+const char* RendererProfiler::getPhaseName(RendererPhase phase)
+{
+	return s_phaseNames[phase];
+}
+
+NS_CC_END
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+#include "platform/CCPlatformMacros.h"
+
+// set to 1 to time the phases of Renderer::render. when 0 the phase scopes compile to nothing
+#ifndef CC_RENDERER_PROFILING
+#define CC_RENDERER_PROFILING 0
+#endif
+
+NS_CC_BEGIN
+
+enum RendererPhase {
+	RENDERER_PHASE_SORT, // RenderQueue::sort of every queue
+	RENDERER_PHASE_GATHER, // makeSingleRenderCommandList, the vertex gathering and batching
+	RENDERER_PHASE_MAP_BUFFERS, // mapArbitraryBuffers
+	RENDERER_PHASE_DRAW, // processing the draw packet stream: the batch draws and the non batched commands
+	RENDERER_PHASE_COUNT
+};
+
+// the timings of a single frame. times are in nanoseconds, the starts are relative to the creation of the profiler
+struct CC_DLL RendererFrameStats {
+	long long frameStart;
+	long long frameTime;
+	long long phaseStart[RENDERER_PHASE_COUNT];
+	long long phaseTime[RENDERER_PHASE_COUNT];
+	ssize_t drawnBatches;
+	ssize_t drawnVertices;
+};
+
+/* Keeps the stats of the last frames of a renderer in a ring buffer.
+Percentiles are computed over the frames currently in the ring */
+class CC_DLL RendererProfiler {
+public:
+	RendererProfiler(int capacity = 240);
+	~RendererProfiler();
+
+	// drops all recorded frames and reallocates the ring
+	void setCapacity(int capacity);
+	int getCapacity() const { return _capacity; }
+	// the number of frames in the ring, at most the capacity
+	int getFrameCount() const { return _count; }
+	// 0 is the oldest frame in the ring, getFrameCount() - 1 the latest
+	const RendererFrameStats& getFrame(int index) const;
+	void clear();
+
+	void beginFrame(ssize_t drawnBatches, ssize_t drawnVertices);
+	void endFrame(ssize_t drawnBatches, ssize_t drawnVertices);
+
+	inline void beginPhase(RendererPhase phase) {
+		_current.phaseStart[phase] = now();
+	}
+	inline void endPhase(RendererPhase phase) {
+		_current.phaseTime[phase] += now() - _current.phaseStart[phase];
+	}
+
+	// percentile (0 - 100) of the given phase over the frames in the ring, RENDERER_PHASE_COUNT gives the whole frame
+	long long getPercentile(RendererPhase phase, float percentile) const;
+	long long getP50(RendererPhase phase = RENDERER_PHASE_COUNT) const { return getPercentile(phase, 50); }
+	long long getP95(RendererPhase phase = RENDERER_PHASE_COUNT) const { return getPercentile(phase, 95); }
+	long long getP99(RendererPhase phase = RENDERER_PHASE_COUNT) const { return getPercentile(phase, 99); }
+
+	// the frames in the ring as chrome trace event json (chrome://tracing, perfetto)
+	std::string toChromeTrace() const;
+	// writes toChromeTrace to a local file, returns false if it could not be written
+	bool exportChromeTrace(const std::string& path) const;
+
+	static const char* getPhaseName(RendererPhase phase);
+
+protected:
+	inline long long now() const {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _epoch).count();
+	}
+
+	RendererFrameStats* _frames;
+	int _capacity;
+	int _count;
+	int _next;
+
+	RendererFrameStats _current;
+	std::chrono::steady_clock::time_point _epoch;
+};
+
+// times the enclosing scope as the given phase
+class RendererPhaseScope {
+public:
+	RendererPhaseScope(RendererProfiler* profiler, RendererPhase phase) : _profiler(profiler), _phase(phase) {
+		_profiler->beginPhase(_phase);
+	}
+	~RendererPhaseScope() {
+		_profiler->endPhase(_phase);
+	}
+
+private:
+	RendererProfiler* _profiler;
+	RendererPhase _phase;
+};
+
+#if CC_RENDERER_PROFILING
+#define CC_RENDERER_PROFILE_CONCAT_(a, b) a##b
+#define CC_RENDERER_PROFILE_CONCAT(a, b) CC_RENDERER_PROFILE_CONCAT_(a, b)
+#define CC_RENDERER_PROFILE_PHASE(profiler, phase) cocos2d::RendererPhaseScope CC_RENDERER_PROFILE_CONCAT(__rendererPhaseScope, __LINE__)(profiler, phase)
+#define CC_RENDERER_PROFILE_BEGIN_FRAME(profiler, batches, vertices) (profiler)->beginFrame(batches, vertices)
+#define CC_RENDERER_PROFILE_END_FRAME(profiler, batches, vertices) (profiler)->endFrame(batches, vertices)
+#else
+#define CC_RENDERER_PROFILE_PHASE(profiler, phase)
+#define CC_RENDERER_PROFILE_BEGIN_FRAME(profiler, batches, vertices)
+#define CC_RENDERER_PROFILE_END_FRAME(profiler, batches, vertices)
+#endif
+
+NS_CC_END
@@ -0,0 +1,192 @@
+#include "renderer/CCSpriteBatchCommand.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CC_SPRITE_BATCH_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CC_SPRITE_BATCH_NEON 1
+#endif
+
+NS_CC_BEGIN
+
+const ssize_t SpriteBatchCommand::MAX_SPRITES;
+
+static_assert(sizeof(V3F_C4B_T2F) == 24, "expand writes V3F_C4B_T2F as 6 packed floats");
+
+#if !CC_SPRITE_BATCH_SSE
+// the color is copied as bytes, passing it around as a float could change it, x87 loads quiet signaling nan patterns
+static inline void setVertex(V3F_C4B_T2F& vertex, float x, float y, float z, const Color4B& color, float u, float v)
+{
+	vertex.vertices.x = x;
+	vertex.vertices.y = y;
+	vertex.vertices.z = z;
+	vertex.colors = color;
+	vertex.texCoords.u = u;
+	vertex.texCoords.v = v;
+}
+#endif
+
+SpriteBatchRecord SpriteBatchRecord::make(const Vec2& position, const Size& size, float rotation, const Vec2& anchor, const Rect& texRect, const Color4B& color)
+{
+	// cocos rotates clockwise
+	float radians = -rotation * (float)M_PI / 180.0f;
+	float cosR = cosf(radians);
+	float sinR = sinf(radians);
+
+	SpriteBatchRecord record;
+	record.a = size.width * cosR;
+	record.b = size.width * sinR;
+	record.c = -size.height * sinR;
+	record.d = size.height * cosR;
+	record.x = position.x - anchor.x * record.a - anchor.y * record.c;
+	record.y = position.y - anchor.x * record.b - anchor.y * record.d;
+	record.u0 = texRect.getMinX();
+	record.v0 = texRect.getMinY();
+	record.u1 = texRect.getMaxX();
+	record.v1 = texRect.getMaxY();
+	record.color = color;
+	return record;
+}
+
+SpriteBatchCommand::SpriteBatchCommand()
+	: _sprites(nullptr)
+	, _spriteCount(0)
+	, _z(0)
+{
+}
+
+void SpriteBatchCommand::init(float globalOrder, Material2D* material2d, const SpriteBatchRecord* sprites, ssize_t spriteCount, const Mat4& mv, uint32_t flags)
+{
+	CCASSERT(material2d && material2d->getVertexSize() == sizeof(V3F_C4B_T2F) && material2d->getPrimitiveType() == MaterialPrimitiveType::TRIANGLE,
+		"Sprite batches need a V3F_C4B_T2F triangle material");
+	CCASSERT(spriteCount > 0 && spriteCount <= MAX_SPRITES, "Invalid sprite count");
+
+	_sprites = sprites;
+	_spriteCount = spriteCount;
+
+	// a 2d model view is folded into the expansion, the renderer skips the transform of the identity
+	const float* m = mv.m;
+	bool is2D = m[2] == 0 && m[3] == 0 && m[6] == 0 && m[7] == 0 && m[15] == 1;
+	if (is2D) {
+		float transform[6] = { m[0], m[1], m[4], m[5], m[12], m[13] };
+		memcpy(_transform, transform, sizeof(_transform));
+		_z = m[14];
+	}
+	else {
+		float identity[6] = { 1, 0, 0, 1, 0, 0 };
+		memcpy(_transform, identity, sizeof(_transform));
+		_z = 0;
+	}
+
+	initEmitter(globalOrder, material2d, spriteCount * 4, spriteCount * 6,
+		[this](byte* vertices, unsigned short* indices, unsigned short indexBase) { emit(vertices, indices, indexBase); },
+		is2D ? Mat4::IDENTITY : mv, true, flags);
+}
+
+void SpriteBatchCommand::emit(byte* vertices, unsigned short* indices, unsigned short indexBase)
+{
+	expand(_sprites, _spriteCount, _transform, _z, reinterpret_cast<V3F_C4B_T2F*>(vertices));
+	writeIndices(_spriteCount, indexBase, indices);
+}
+
+void SpriteBatchCommand::expand(const SpriteBatchRecord* sprites, ssize_t spriteCount, const float* transform, float z, V3F_C4B_T2F* vertices)
+{
+	const SpriteBatchRecord* sprite = sprites;
+	const SpriteBatchRecord* end = sprites + spriteCount;
+
+#if CC_SPRITE_BATCH_SSE
+	float* out = reinterpret_cast<float*>(vertices);
+
+	// one sprite per iteration: the 4 corners are computed as two (x, y, x, y) vectors and the 24 floats of the quad are shuffled together
+	const __m128 col0 = _mm_setr_ps(transform[0], transform[1], transform[0], transform[1]);
+	const __m128 col1 = _mm_setr_ps(transform[2], transform[3], transform[2], transform[3]);
+	const __m128 translation = _mm_setr_ps(transform[4], transform[5], transform[4], transform[5]);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 zv = _mm_set1_ps(z);
+
+	for (; sprite < end; sprite++, out += 24) {
+		__m128 edges = _mm_loadu_ps(&sprite->a); // a b c d
+		__m128 position = _mm_loadl_pi(zero, reinterpret_cast<const __m64*>(&sprite->x)); // x y 0 0
+		__m128 uv = _mm_loadu_ps(&sprite->u0); // u0 v0 u1 v1
+		// the color bytes are loaded straight into a register, not through a float variable
+		__m128 zc = _mm_unpacklo_ps(zv, _mm_load1_ps(reinterpret_cast<const float*>(&sprite->color))); // z c z c
+
+		// transformed edges: a' b' c' d'
+		edges = _mm_add_ps(
+			_mm_mul_ps(col0, _mm_shuffle_ps(edges, edges, _MM_SHUFFLE(2, 2, 0, 0))),
+			_mm_mul_ps(col1, _mm_shuffle_ps(edges, edges, _MM_SHUFFLE(3, 3, 1, 1))));
+		// transformed bottom left corner, twice
+		position = _mm_add_ps(translation, _mm_add_ps(
+			_mm_mul_ps(col0, _mm_shuffle_ps(position, position, _MM_SHUFFLE(0, 0, 0, 0))),
+			_mm_mul_ps(col1, _mm_shuffle_ps(position, position, _MM_SHUFFLE(1, 1, 1, 1)))));
+
+		__m128 left = _mm_add_ps(position, _mm_movehl_ps(zero, edges)); // tl bl
+		__m128 right = _mm_add_ps(left, _mm_movelh_ps(edges, edges)); // tr br
+
+		_mm_storeu_ps(out, _mm_movelh_ps(left, zc)); // tl.x tl.y z c
+		_mm_storeu_ps(out + 4, _mm_shuffle_ps(uv, left, _MM_SHUFFLE(3, 2, 1, 0))); // u0 v0 bl.x bl.y
+		_mm_storeu_ps(out + 8, _mm_shuffle_ps(zc, uv, _MM_SHUFFLE(3, 0, 1, 0))); // z c u0 v1
+		_mm_storeu_ps(out + 12, _mm_movelh_ps(right, zc)); // tr.x tr.y z c
+		_mm_storeu_ps(out + 16, _mm_shuffle_ps(uv, right, _MM_SHUFFLE(3, 2, 1, 2))); // u1 v0 br.x br.y
+		_mm_storeu_ps(out + 20, _mm_shuffle_ps(zc, uv, _MM_SHUFFLE(3, 2, 1, 0))); // z c u1 v1
+	}
+#elif CC_SPRITE_BATCH_NEON
+	// the same corner math as the sse path, the vertices are written field by field
+	const float32x4_t col0 = { transform[0], transform[1], transform[0], transform[1] };
+	const float32x4_t col1 = { transform[2], transform[3], transform[2], transform[3] };
+	const float32x4_t translation = { transform[4], transform[5], transform[4], transform[5] };
+	const float32x2_t zero = vdup_n_f32(0);
+
+	for (; sprite < end; sprite++, vertices += 4) {
+		float32x4_t edges = vld1q_f32(&sprite->a); // a b c d
+		float32x4x2_t split = vtrnq_f32(edges, edges); // a a c c, b b d d
+
+		// transformed edges: a' b' c' d'
+		edges = vaddq_f32(vmulq_f32(col0, split.val[0]), vmulq_f32(col1, split.val[1]));
+		// transformed bottom left corner, twice
+		float32x4_t position = vaddq_f32(vaddq_f32(vmulq_f32(col0, vdupq_n_f32(sprite->x)), vmulq_f32(col1, vdupq_n_f32(sprite->y))), translation);
+
+		float32x4_t left = vaddq_f32(position, vcombine_f32(vget_high_f32(edges), zero)); // tl bl
+		float32x4_t right = vaddq_f32(left, vcombine_f32(vget_low_f32(edges), vget_low_f32(edges))); // tr br
+
+		setVertex(vertices[0], vgetq_lane_f32(left, 0), vgetq_lane_f32(left, 1), z, sprite->color, sprite->u0, sprite->v0);
+		setVertex(vertices[1], vgetq_lane_f32(left, 2), vgetq_lane_f32(left, 3), z, sprite->color, sprite->u0, sprite->v1);
+		setVertex(vertices[2], vgetq_lane_f32(right, 0), vgetq_lane_f32(right, 1), z, sprite->color, sprite->u1, sprite->v0);
+		setVertex(vertices[3], vgetq_lane_f32(right, 2), vgetq_lane_f32(right, 3), z, sprite->color, sprite->u1, sprite->v1);
+	}
+#else
+	for (; sprite < end; sprite++, vertices += 4) {
+		float a = transform[0] * sprite->a + transform[2] * sprite->b;
+		float b = transform[1] * sprite->a + transform[3] * sprite->b;
+		float c = transform[0] * sprite->c + transform[2] * sprite->d;
+		float d = transform[1] * sprite->c + transform[3] * sprite->d;
+		float x = transform[0] * sprite->x + transform[2] * sprite->y + transform[4];
+		float y = transform[1] * sprite->x + transform[3] * sprite->y + transform[5];
+
+		setVertex(vertices[0], x + c, y + d, z, sprite->color, sprite->u0, sprite->v0);
+		setVertex(vertices[1], x, y, z, sprite->color, sprite->u0, sprite->v1);
+		setVertex(vertices[2], x + c + a, y + d + b, z, sprite->color, sprite->u1, sprite->v0);
+		setVertex(vertices[3], x + a, y + b, z, sprite->color, sprite->u1, sprite->v1);
+	}
+#endif
+}
+
+void SpriteBatchCommand::writeIndices(ssize_t spriteCount, unsigned short indexBase, unsigned short* indices)
+{
+	unsigned short base = indexBase;
+	unsigned short* end = indices + spriteCount * 6;
+	for (; indices < end; indices += 6, base += 4) {
+		indices[0] = base;
+		indices[1] = base + 1;
+		indices[2] = base + 2;
+		indices[3] = base + 3;
+		indices[4] = base + 2;
+		indices[5] = base + 1;
+	}
+}
+
+NS_CC_END
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "platform/CCPlatformMacros.h"
+#include "renderer/CCArbitraryVertexCommand.h"
+
+NS_CC_BEGIN
+
+/* A sprite of a SpriteBatchCommand. The quad is the parallelogram spanned by the edges (a, b) and (c, d) from the bottom left
+corner (x, y), so size, rotation and skew are all in the edges */
+struct CC_DLL SpriteBatchRecord {
+	float a, b; // the bottom edge, from the bottom left to the bottom right corner
+	float c, d; // the left edge, from the bottom left to the top left corner
+	float x, y; // the bottom left corner
+	float u0, v0, u1, v1; // the texture rect, v0 is at the top
+	Color4B color;
+
+	// a sprite of the given size rotated clockwise by rotation degrees around its anchor point, which is placed at position
+	static SpriteBatchRecord make(const Vec2& position, const Size& size, float rotation, const Vec2& anchor, const Rect& texRect, const Color4B& color);
+};
+
+/* Draws an array of sprites sharing one material with a single command. The sprites are expanded to quads while the renderer gathers
+the command, straight into the renderers vertex buffer, so they cost one submission instead of a QuadCommand each.
+The material has to use the V3F_C4B_T2F format and triangles. The records are read when the frame is rendered, keep them alive until then */
+class CC_DLL SpriteBatchCommand : public ArbitraryVertexCommand {
+public:
+	// the quads of one command have to be addressable with unsigned short indices
+	static const ssize_t MAX_SPRITES = 0x10000 / 4;
+
+	SpriteBatchCommand();
+
+	/* A 2d model view is applied while the quads are expanded, any other one by the renderer like for other cpu transformed commands */
+	void init(float globalOrder, Material2D* material2d, const SpriteBatchRecord* sprites, ssize_t spriteCount, const Mat4& mv, uint32_t flags = 0);
+
+	inline const SpriteBatchRecord* getSprites() const { return _sprites; }
+	inline ssize_t getSpriteCount() const { return _spriteCount; }
+
+	// writes 4 vertices per sprite in tl, bl, tr, br order. transform is the 2x3 affine matrix (m00, m10, m01, m11, tx, ty), z the z of all vertices
+	static void expand(const SpriteBatchRecord* sprites, ssize_t spriteCount, const float* transform, float z, V3F_C4B_T2F* vertices);
+	// writes 6 indices per sprite
+	static void writeIndices(ssize_t spriteCount, unsigned short indexBase, unsigned short* indices);
+
+protected:
+	void emit(byte* vertices, unsigned short* indices, unsigned short indexBase);
+
+	const SpriteBatchRecord* _sprites;
+	ssize_t _spriteCount;
+	float _transform[6];
+	float _z;
+};
+
+NS_CC_END
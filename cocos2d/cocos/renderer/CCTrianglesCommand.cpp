@@ -41,22 +41,6 @@ TrianglesCommand::TrianglesCommand()
 	_type = RenderCommand::Type::ARBITRARY_VERTEX_COMMAND;
 }
 
-static VertexStreamAttributes* s_triangleAttributes = nullptr;
-
-static VertexStreamAttributes* getTriangleAttributes() {
-	if (s_triangleAttributes == nullptr) {
-		s_triangleAttributes = new VertexStreamAttributes();
-		s_triangleAttributes->infos = new VertexStreamAttribute[3];
-		s_triangleAttributes->infos[0] = VertexStreamAttribute(0, GLProgram::VERTEX_ATTRIB_POSITION, GL_FLOAT, 3, false);
-		s_triangleAttributes->infos[1] = VertexStreamAttribute(12, GLProgram::VERTEX_ATTRIB_COLOR, GL_UNSIGNED_BYTE, 4, true);
-		s_triangleAttributes->infos[2] = VertexStreamAttribute(16, GLProgram::VERTEX_ATTRIB_TEX_COORD, GL_FLOAT, 2, false);
-		s_triangleAttributes->stride = 24;
-		s_triangleAttributes->count = 3;
-		s_triangleAttributes->generateID();
-	}
-	return s_triangleAttributes;
-}
-
 void TrianglesCommand::init(float globalOrder, GLuint textureID, GLProgramState* glProgramState, BlendFunc blendType, const Triangles& triangles, const Mat4& mv, uint32_t flags)
 {
 	CCASSERT(glProgramState, "Invalid GLProgramState");
@@ -72,7 +56,7 @@ void TrianglesCommand::init(float globalOrder, GLuint textureID, GLProgramState*
 		_blendType = blendType;
 		_glProgramState = glProgramState;
 
-		_tmpMaterial->init(_glProgramState, &textureID, 1, blendType, *getTriangleAttributes(), MaterialPrimitiveType::TRIANGLE);
+		_tmpMaterial->init(_glProgramState, &textureID, 1, blendType, *VertexStreamAttributes::getV3F_C4B_T2F(), MaterialPrimitiveType::TRIANGLE);
 	}
 
 	ArbitraryVertexCommand::Data data;
@@ -0,0 +1,180 @@
+#include "renderer/CCVertexCacheOptimizer.h"
+
+#include <string.h>
+
+#include "base/ccMacros.h"
+
+#include "xxhash.h"
+
+NS_CC_BEGIN
+
+const int VertexCacheOptimizer::DEFAULT_CACHE_SIZE;
+
+void VertexCacheOptimizer::optimizeIndices(GLushort* indices, ssize_t indexCount, ssize_t vertexCount, int cacheSize)
+{
+	CCASSERT(indexCount % 3 == 0, "Only triangle lists can be optimized");
+	ssize_t triangleCount = indexCount / 3;
+	if (triangleCount < 2) {
+		return;
+	}
+
+	// vertex -> triangle adjacency
+	std::vector<int> liveTriangles(vertexCount, 0);
+	for (ssize_t i = 0; i < indexCount; i++) {
+		liveTriangles[indices[i]]++;
+	}
+	std::vector<int> adjacencyOffsets(vertexCount + 1, 0);
+	for (ssize_t v = 0; v < vertexCount; v++) {
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+	}
+	std::vector<int> adjacency(indexCount);
+	std::vector<int> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (ssize_t i = 0; i < indexCount; i++) {
+		adjacency[fill[indices[i]]++] = (int)(i / 3);
+	}
+
+	std::vector<GLushort> source(indices, indices + indexCount);
+	std::vector<int> cacheTime(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<int> deadEnd;
+	std::vector<int> candidates;
+	int timestamp = cacheSize + 1;
+	ssize_t cursor = 0;
+	GLushort* out = indices;
+
+	int fanning = source[0];
+	while (fanning >= 0) {
+		// emit all triangles around the fanning vertex
+		candidates.clear();
+		for (int a = adjacencyOffsets[fanning]; a < adjacencyOffsets[fanning + 1]; a++) {
+			int t = adjacency[a];
+			if (emitted[t]) {
+				continue;
+			}
+			for (int k = 0; k < 3; k++) {
+				int v = source[t * 3 + k];
+				*(out++) = (GLushort)v;
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				liveTriangles[v]--;
+				if (timestamp - cacheTime[v] > cacheSize) {
+					cacheTime[v] = timestamp++;
+				}
+			}
+			emitted[t] = true;
+		}
+
+		// the next fanning vertex is the candidate that stays longest in the cache
+		fanning = -1;
+		int best = -1;
+		for (int v : candidates) {
+			if (liveTriangles[v] <= 0) {
+				continue;
+			}
+			int priority = 0;
+			if (timestamp - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize) {
+				priority = timestamp - cacheTime[v];
+			}
+			if (priority > best) {
+				best = priority;
+				fanning = v;
+			}
+		}
+
+		if (fanning == -1) {
+			// dead end: go back to a recently used vertex or continue with the next one in input order
+			while (!deadEnd.empty()) {
+				int v = deadEnd.back();
+				deadEnd.pop_back();
+				if (liveTriangles[v] > 0) {
+					fanning = v;
+					break;
+				}
+			}
+			while (fanning == -1 && cursor < vertexCount) {
+				if (liveTriangles[cursor] > 0) {
+					fanning = (int)cursor;
+				}
+				cursor++;
+			}
+		}
+	}
+}
+
+void VertexCacheOptimizer::optimizeVertexFetch(byte* vertices, ssize_t vertexCount, GLuint vertexStride, GLushort* indices, ssize_t indexCount)
+{
+	std::vector<int> remap(vertexCount, -1);
+	int next = 0;
+	for (ssize_t i = 0; i < indexCount; i++) {
+		if (remap[indices[i]] == -1) {
+			remap[indices[i]] = next++;
+		}
+		indices[i] = (GLushort)remap[indices[i]];
+	}
+	for (ssize_t v = 0; v < vertexCount; v++) {
+		if (remap[v] == -1) {
+			remap[v] = next++;
+		}
+	}
+
+	std::vector<byte> source(vertices, vertices + vertexCount * vertexStride);
+	for (ssize_t v = 0; v < vertexCount; v++) {
+		memcpy(vertices + remap[v] * vertexStride, source.data() + v * vertexStride, vertexStride);
+	}
+}
+
+VertexCacheStats VertexCacheOptimizer::simulate(const GLushort* indices, ssize_t indexCount, ssize_t vertexCount, int cacheSize)
+{
+	VertexCacheStats stats = { 0, 0 };
+	if (indexCount < 3) {
+		return stats;
+	}
+
+	// a vertex is in the fifo if it was inserted less than cacheSize misses ago
+	std::vector<int> insertedAt(vertexCount, -cacheSize - 1);
+	std::vector<bool> referenced(vertexCount, false);
+	int misses = 0;
+	int referencedCount = 0;
+	for (ssize_t i = 0; i < indexCount; i++) {
+		GLushort v = indices[i];
+		if (misses - insertedAt[v] > cacheSize) {
+			insertedAt[v] = misses++;
+		}
+		if (!referenced[v]) {
+			referenced[v] = true;
+			referencedCount++;
+		}
+	}
+
+	stats.acmr = misses / (float)(indexCount / 3);
+	stats.atvr = misses / (float)referencedCount;
+	return stats;
+}
+
+bool VertexCacheOptimizer::optimize(ArbitraryVertexCommand::Data& data, GLuint vertexStride, int cacheSize)
+{
+	if (data.indexData == nullptr || data.indexCount < 6 || data.indexCount % 3 != 0) {
+		return false;
+	}
+
+	// the entry holds the reordered data and cant be compared with the source, so the key has to be wide enough to never collide in practice
+	ssize_t vertexSize = data.vertexCount * vertexStride;
+	unsigned long long hash = XXH64(data.vertexData, vertexSize, vertexStride);
+	hash = XXH64(data.indexData, data.indexCount * sizeof(GLushort), hash);
+
+	auto it = _cache.find(hash);
+	if (it == _cache.end() || it->second.vertices.size() != (size_t)vertexSize || it->second.indices.size() != (size_t)data.indexCount) {
+		Entry& entry = _cache[hash];
+		entry.vertices.assign(data.vertexData, data.vertexData + vertexSize);
+		entry.indices.assign(data.indexData, data.indexData + data.indexCount);
+		optimizeIndices(entry.indices.data(), data.indexCount, data.vertexCount, cacheSize);
+		optimizeVertexFetch(entry.vertices.data(), data.vertexCount, vertexStride, entry.indices.data(), data.indexCount);
+		it = _cache.find(hash);
+	}
+
+	data.vertexData = it->second.vertices.data();
+	data.indexData = it->second.indices.data();
+	return true;
+}
+
+NS_CC_END
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "platform/CCPlatformMacros.h"
+#include "platform/CCGL.h"
+#include "renderer/CCArbitraryVertexCommand.h"
+
+NS_CC_BEGIN
+
+struct VertexCacheStats {
+	float acmr; // average cache miss ratio: transformed vertices per triangle, 0.5 is the best possible for big regular grids
+	float atvr; // average transform to vertex ratio: transformed vertices per referenced vertex, 1 is optimal
+};
+
+/* Reorders the triangle list data of big static commands (terrain, tilemap chunks, tessellated shapes) for the post transform vertex cache
+with Tipsify, then the vertices in first use order for fetch locality.
+Reordering changes the order triangles are drawn in, so only use it for meshes whose triangles dont overlap or that are drawn opaque */
+class CC_DLL VertexCacheOptimizer {
+public:
+	static const int DEFAULT_CACHE_SIZE = 16;
+
+	// reorders the triangles of a triangle list in place
+	static void optimizeIndices(GLushort* indices, ssize_t indexCount, ssize_t vertexCount, int cacheSize = DEFAULT_CACHE_SIZE);
+	// reorders the vertices in the order the indices first use them and remaps the indices. unused vertices are moved to the end
+	static void optimizeVertexFetch(byte* vertices, ssize_t vertexCount, GLuint vertexStride, GLushort* indices, ssize_t indexCount);
+	// simulates a fifo post transform cache
+	static VertexCacheStats simulate(const GLushort* indices, ssize_t indexCount, ssize_t vertexCount, int cacheSize = DEFAULT_CACHE_SIZE);
+
+	/* Points data at an optimized copy of its vertices and indices. The copy is made once per content and kept until clear,
+	data has to be an indexed triangle list. The content is identified by a 64 bit hash and its sizes. Returns false if the data was left unchanged */
+	bool optimize(ArbitraryVertexCommand::Data& data, GLuint vertexStride, int cacheSize = DEFAULT_CACHE_SIZE);
+	void clear() { _cache.clear(); }
+
+protected:
+	struct Entry {
+		std::vector<byte> vertices;
+		std::vector<GLushort> indices;
+	};
+	std::unordered_map<unsigned long long, Entry> _cache;
+};
+
+NS_CC_END
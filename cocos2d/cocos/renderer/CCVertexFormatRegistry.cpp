@@ -0,0 +1,101 @@
+#include "renderer/CCVertexFormatRegistry.h"
+
+#include <string.h>
+
+#include "renderer/CCRenderDevice.h"
+#include "base/ccMacros.h"
+
+#include "xxhash.h"
+
+NS_CC_BEGIN
+
+const int VertexFormat::MAX_ATTRIBUTES;
+
+void VertexFormat::apply(RenderDevice* device, void* bufferOffset) const
+{
+	device->enableVertexAttribs(enableMask);
+
+	const VertexFormatAttribute* attribute = attributes;
+	const VertexFormatAttribute* end = attributes + count;
+	for (; attribute < end; attribute++) {
+		device->vertexAttribPointer(attribute->semantic, attribute->size, attribute->type, attribute->normalize, stride, (GLvoid*)((uintptr_t)bufferOffset + attribute->offset));
+	}
+}
+
+VertexFormatRegistry* VertexFormatRegistry::getInstance()
+{
+	static VertexFormatRegistry s_instance;
+	return &s_instance;
+}
+
+VertexFormatRegistry::~VertexFormatRegistry()
+{
+	for (auto format : _formats) {
+		delete format;
+	}
+}
+
+const VertexFormat* VertexFormatRegistry::intern(const VertexFormatAttribute* attributes, uint32_t count, GLuint stride)
+{
+	CCASSERT(count <= VertexFormat::MAX_ATTRIBUTES, "Too many vertex attributes");
+
+	// hash the fields one by one, the padding of VertexFormatAttribute is undefined
+	uint32_t values[5 * VertexFormat::MAX_ATTRIBUTES + 1];
+	for (uint32_t i = 0; i < count; i++) {
+		values[i * 5] = attributes[i].semantic;
+		values[i * 5 + 1] = attributes[i].size;
+		values[i * 5 + 2] = attributes[i].type;
+		values[i * 5 + 3] = attributes[i].normalize;
+		values[i * 5 + 4] = attributes[i].offset;
+	}
+	values[count * 5] = stride;
+	uint32_t hash = XXH32(values, (count * 5 + 1) * sizeof(uint32_t), 0);
+
+	// the hash only finds the candidates, equality is decided by the layout
+	auto range = _formatsByHash.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it) {
+		const VertexFormat* format = it->second;
+		if (format->stride != stride || format->count != count) {
+			continue;
+		}
+		bool equal = true;
+		for (uint32_t i = 0; i < count && equal; i++) {
+			const VertexFormatAttribute& a = format->attributes[i];
+			const VertexFormatAttribute& b = attributes[i];
+			equal = a.semantic == b.semantic && a.size == b.size && a.type == b.type && a.normalize == b.normalize && a.offset == b.offset;
+		}
+		if (equal) {
+			return format;
+		}
+	}
+
+	VertexFormat* format = new VertexFormat();
+	memset(format, 0, sizeof(VertexFormat));
+	format->stride = stride;
+	format->count = count;
+	for (uint32_t i = 0; i < count; i++) {
+		format->attributes[i] = attributes[i];
+		format->enableMask |= 1 << attributes[i].semantic;
+	}
+	_formats.push_back(format);
+	format->id = (uint32_t)_formats.size();
+	_formatsByHash.insert(std::make_pair(hash, format));
+	return format;
+}
+
+const VertexFormat* VertexFormatRegistry::intern(const VertexStreamAttribute* infos, uint32_t count, GLuint stride)
+{
+	CCASSERT(count <= VertexFormat::MAX_ATTRIBUTES, "Too many vertex attributes");
+
+	VertexFormatAttribute attributes[VertexFormat::MAX_ATTRIBUTES];
+	for (uint32_t i = 0; i < count; i++) {
+		attributes[i].semantic = infos[i]._semantic;
+		attributes[i].size = infos[i]._size;
+		attributes[i].type = infos[i]._type;
+		attributes[i].normalize = infos[i]._normalize;
+		attributes[i].offset = infos[i]._offset;
+	}
+	return intern(attributes, count, stride);
+}
+
+NS_CC_END
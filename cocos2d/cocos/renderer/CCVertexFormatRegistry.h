@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "platform/CCPlatformMacros.h"
+#include "platform/CCGL.h"
+#include "renderer/CCVertexIndexData.h"
+
+NS_CC_BEGIN
+
+class RenderDevice;
+
+// one attribute of a vertex format, the arguments of its glVertexAttribPointer call without the stride
+struct VertexFormatAttribute {
+	GLuint semantic;
+	GLint size;
+	GLenum type;
+	GLboolean normalize;
+	GLuint offset;
+};
+
+// declares an attribute from a member of a vertex struct, so built-in layouts can be declared as constant arrays
+#define CC_VERTEX_FORMAT_ATTRIBUTE(vertexType, member, semantic, size, type, normalize) \
+	{ (GLuint)(semantic), (GLint)(size), (GLenum)(type), (GLboolean)(normalize), (GLuint)offsetof(vertexType, member) }
+
+/* An interned vertex layout, owned by the VertexFormatRegistry. Equal layouts share one instance,
+so formats can be compared by pointer or id */
+struct CC_DLL VertexFormat {
+	static const int MAX_ATTRIBUTES = 16;
+
+	uint32_t id; // dense, starting at 1
+	GLuint stride;
+	uint32_t enableMask; // one bit per attribute semantic
+	uint32_t count;
+	VertexFormatAttribute attributes[MAX_ATTRIBUTES];
+
+	void apply(RenderDevice* device, void* bufferOffset) const;
+};
+
+class CC_DLL VertexFormatRegistry {
+public:
+	static VertexFormatRegistry* getInstance();
+
+	// returns the format with the given layout, registering it the first time. the attributes are copied
+	const VertexFormat* intern(const VertexFormatAttribute* attributes, uint32_t count, GLuint stride);
+	const VertexFormat* intern(const VertexStreamAttribute* infos, uint32_t count, GLuint stride);
+	template <size_t N>
+	inline const VertexFormat* intern(const VertexFormatAttribute (&attributes)[N], GLuint stride) { return intern(attributes, (uint32_t)N, stride); }
+
+	// id 0 is never used
+	inline const VertexFormat* getFormat(uint32_t id) const { return id > 0 && id <= _formats.size() ? _formats[id - 1] : nullptr; }
+	inline size_t getFormatCount() const { return _formats.size(); }
+
+protected:
+	VertexFormatRegistry() {}
+	~VertexFormatRegistry();
+
+	std::vector<VertexFormat*> _formats; // by id - 1
+	std::unordered_multimap<uint32_t, VertexFormat*> _formatsByHash;
+};
+
+NS_CC_END
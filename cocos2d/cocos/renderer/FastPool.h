@@ -11,6 +11,7 @@ public:
 		_listSize = 10;
 		_poolList = (T*) malloc(_listSize * sizeof(T));
 		_currentElementCount = 0;
+		_takenCount = 0;
 		_createDelegate = createDelegate;
 	}
 
@@ -19,6 +20,7 @@ public:
 	}
 
 	inline T pop() {
+		_takenCount++;
 		if (_currentElementCount <= 0) {
 			return _createDelegate();
 		}
@@ -39,10 +41,20 @@ public:
 		return _currentElementCount;
 	}
 
+	// the elements popped since the last reset, including the newly created ones
+	int getTakenCount() {
+		return _takenCount;
+	}
+
+	void resetTakenCount() {
+		_takenCount = 0;
+	}
+
 protected:
 	T(*_createDelegate)();
 
 	T* _poolList;
 	int _currentElementCount;
+	int _takenCount;
 	int _listSize;
 };
\ No newline at end of file
@@ -42,6 +42,10 @@ public:
 		return list + index;
 	}
 
+	inline size_t size() const {
+		return elementCount;
+	}
+
 	void clear() {
 		reserveIndex = 0;
 		elementCount = 0;
@@ -1,8 +1,13 @@
 #include "Material2D.h"
+
+#include <algorithm>
+
 #include "renderer\CCTexture2D.h"
 #include "renderer\CCGLProgramState.h"
 #include "renderer\CCGLProgram.h"
 #include "renderer\CCRenderer.h"
+#include "renderer/CCRenderDevice.h"
+#include "renderer/CCVertexFormatRegistry.h"
 
 #include "base/ccMacros.h"
 
@@ -12,51 +17,88 @@
 
 NS_CC_BEGIN
 
-int generateVertexAttribInfoId(VertexStreamAttribute info) {
-	int data[5] = { (int)info._semantic, (int)info._size, (int)info._type, (int)info._normalize, (int)info._offset };
-	return XXH32(data, sizeof(data), 0);
-}
+// the built-in layouts, declared at compile time
+static const VertexFormatAttribute s_V3F_C4B_T2FAttributes[] = {
+	CC_VERTEX_FORMAT_ATTRIBUTE(V3F_C4B_T2F, vertices, GLProgram::VERTEX_ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE),
+	CC_VERTEX_FORMAT_ATTRIBUTE(V3F_C4B_T2F, colors, GLProgram::VERTEX_ATTRIB_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE),
+	CC_VERTEX_FORMAT_ATTRIBUTE(V3F_C4B_T2F, texCoords, GLProgram::VERTEX_ATTRIB_TEX_COORD, 2, GL_FLOAT, GL_FALSE),
+};
+// the attributes are expanded by gl (z = 0, w = 1, tex coords normalized to 0..1), so the default shaders can be used unchanged
+static const VertexFormatAttribute s_V2F_C4B_T2USAttributes[] = {
+	CC_VERTEX_FORMAT_ATTRIBUTE(V2F_C4B_T2US, vertices, GLProgram::VERTEX_ATTRIB_POSITION, 2, GL_FLOAT, GL_FALSE),
+	CC_VERTEX_FORMAT_ATTRIBUTE(V2F_C4B_T2US, colors, GLProgram::VERTEX_ATTRIB_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE),
+	CC_VERTEX_FORMAT_ATTRIBUTE(V2F_C4B_T2US, texCoords, GLProgram::VERTEX_ATTRIB_TEX_COORD, 2, GL_UNSIGNED_SHORT, GL_TRUE),
+};
 
 void VertexStreamAttributes::generateID() {
-	int* data = new int[count + 1];
-	int j = 0;
-	for (auto i = infos; i < infos + count; i++, j++) {
-		data[j] = generateVertexAttribInfoId(*i);
-	}
-	data[count] = stride;
-	id = XXH32(data, (count + 1) * sizeof(int), 0);
-	delete[] data;
+	format = VertexFormatRegistry::getInstance()->intern(infos, count, stride);
+	id = format->id;
 }
 
 void VertexStreamAttributes::apply(void* bufferOffset)
 {
-	int indices = 0;
+	apply(RenderDevice::getDefault(), bufferOffset);
+}
 
-	for (auto i = infos; i < infos + count; i++) {
-		indices |= (1 << i->_semantic);
+void VertexStreamAttributes::apply(RenderDevice* device, void* bufferOffset)
+{
+	if (format == nullptr) {
+		generateID();
 	}
+	format->apply(device, bufferOffset);
+}
+
+// wraps an interned built-in format, the infos are kept for code that reads them
+static VertexStreamAttributes* createBuiltInAttributes(const VertexFormat* format) {
+	VertexStreamAttributes* attributes = new VertexStreamAttributes();
+	attributes->infos = new VertexStreamAttribute[format->count];
+	for (uint32_t i = 0; i < format->count; i++) {
+		const VertexFormatAttribute& attribute = format->attributes[i];
+		attributes->infos[i] = VertexStreamAttribute(attribute.offset, attribute.semantic, attribute.type, attribute.size, attribute.normalize != GL_FALSE);
+	}
+	attributes->count = format->count;
+	attributes->stride = format->stride;
+	attributes->format = format;
+	attributes->id = format->id;
+	return attributes;
+}
 
-	GL::enableVertexAttribs(indices);
+static VertexStreamAttributes* s_V3F_C4B_T2F = nullptr;
+static VertexStreamAttributes* s_V2F_C4B_T2US = nullptr;
 
-	for (auto i = infos; i < infos + count; i++) {
-		glVertexAttribPointer(i->_semantic, i->_size, i->_type, i->_normalize, stride, (GLvoid*)((GLuint)bufferOffset + i->_offset));
+VertexStreamAttributes* VertexStreamAttributes::getV3F_C4B_T2F() {
+	if (s_V3F_C4B_T2F == nullptr) {
+		s_V3F_C4B_T2F = createBuiltInAttributes(VertexFormatRegistry::getInstance()->intern(s_V3F_C4B_T2FAttributes, sizeof(V3F_C4B_T2F)));
 	}
+	return s_V3F_C4B_T2F;
+}
+
+VertexStreamAttributes* VertexStreamAttributes::getV2F_C4B_T2US() {
+	if (s_V2F_C4B_T2US == nullptr) {
+		s_V2F_C4B_T2US = createBuiltInAttributes(VertexFormatRegistry::getInstance()->intern(s_V2F_C4B_T2USAttributes, sizeof(V2F_C4B_T2US)));
+	}
+	return s_V2F_C4B_T2US;
 }
 
 VertexStreamAttributes::VertexStreamAttributes() {
 	id = 0;
 	count = 0;
+	stride = 0;
 	infos = nullptr;
+	format = nullptr;
 }
 VertexStreamAttributes::~VertexStreamAttributes() {
 }
 
 Material2D::Material2D()
+	: _paletteSize(0)
+	, _paletteUniformLocation(-1)
 {
 }
 
 Material2D::~Material2D()
 {
+	delete[] _paletteVertexStreamAttributes.infos;
 }
 
 void Material2D::init(GLProgramState * program, Texture2D** textures, int texturesCount, BlendFunc blendFunc, VertexAttribInfoFormat format, MaterialPrimitiveType primitiveType)
@@ -72,7 +114,11 @@ void Material2D::init(GLProgramState * program, Texture2D** textures, int textur
 	_textureCount = texturesCount;
 	_blendFunc = blendFunc;
 	_vertexStreamAttributes = format;
+	if (_vertexStreamAttributes.format == nullptr) {
+		_vertexStreamAttributes.generateID();
+	}
 	_primitiveType = primitiveType;
+	_batchPrimitiveType = getListPrimitiveType(primitiveType);
 
 	_skipBatching = false;
 
@@ -90,7 +136,11 @@ void Material2D::init(GLProgramState * program, GLuint * textures, int texturesC
 	_textureCount = texturesCount;
 	_blendFunc = blendFunc;
 	_vertexStreamAttributes = format;
+	if (_vertexStreamAttributes.format == nullptr) {
+		_vertexStreamAttributes.generateID();
+	}
 	_primitiveType = primitiveType;
+	_batchPrimitiveType = getListPrimitiveType(primitiveType);
 
 	_skipBatching = false;
 
@@ -98,33 +148,111 @@ void Material2D::init(GLProgramState * program, GLuint * textures, int texturesC
 }
 
 void Material2D::apply(const Mat4& modelView)
+{
+	apply(RenderDevice::getDefault(), modelView);
+}
+
+void Material2D::apply(RenderDevice* device, const Mat4& modelView)
 {
 	int j = 0;
 	for (auto i = _textureNames; i < _textureNames + _textureCount; i++, j++) {
-		GL::bindTexture2DN(j, *i);
+		device->bindTexture2DN(j, *i);
 	}
 
-	GL::blendFunc(_blendFunc.src, _blendFunc.dst);
+	device->blendFunc(_blendFunc.src, _blendFunc.dst);
 
-	_glProgramState->applyGLProgram(modelView);
-	_glProgramState->applyUniforms();
+	device->applyProgram(_glProgramState, modelView);
+}
+
+MaterialPrimitiveType Material2D::getListPrimitiveType(MaterialPrimitiveType type)
+{
+	switch (type) {
+	case MaterialPrimitiveType::TRIANGLE_STRIP:
+	case MaterialPrimitiveType::TRIANGLE_FAN:
+		return MaterialPrimitiveType::TRIANGLE;
+	case MaterialPrimitiveType::LINE_STRIP:
+	case MaterialPrimitiveType::LINE_LOOP:
+		return MaterialPrimitiveType::LINE;
+	default:
+		return type;
+	}
+}
+
+int Material2D::getMaxMatrixPaletteSize()
+{
+	static int maxPaletteSize = -1;
+	if (maxPaletteSize < 0) {
+		GLint vectors = 0;
+#ifdef GL_MAX_VERTEX_UNIFORM_VECTORS
+		glGetIntegerv(GL_MAX_VERTEX_UNIFORM_VECTORS, &vectors);
+#else
+		glGetIntegerv(GL_MAX_VERTEX_UNIFORM_COMPONENTS, &vectors);
+		vectors /= 4;
+#endif
+		// a mat4 takes 4 vectors. the matrix index is stored in an unsigned byte
+		maxPaletteSize = std::min(vectors / 4, 256);
+	}
+	return maxPaletteSize;
+}
+
+void Material2D::setMatrixPalette(int paletteSize)
+{
+	// the program's other uniforms take vectors too, a palette this large only links if it has hardly any
+	int maxPaletteSize = getMaxMatrixPaletteSize();
+	CCASSERT(paletteSize >= 0 && paletteSize <= maxPaletteSize, "The palette doesnt fit into the vertex uniforms or the unsigned byte matrix index");
+	paletteSize = std::max(0, std::min(paletteSize, maxPaletteSize));
+
+	delete[] _paletteVertexStreamAttributes.infos;
+	_paletteVertexStreamAttributes = VertexStreamAttributes();
+	_paletteSize = paletteSize;
+	_paletteUniformLocation = -1;
+
+	if (paletteSize > 0) {
+		_paletteUniformLocation = _glProgramState->getGLProgram()->getUniformLocation("u_matrixPalette");
+		CCASSERT(_paletteUniformLocation != -1, "The program has no u_matrixPalette uniform");
+
+		const VertexStreamAttributes& format = _vertexStreamAttributes;
+		_paletteVertexStreamAttributes.infos = new VertexStreamAttribute[format.count + 1];
+		memcpy(_paletteVertexStreamAttributes.infos, format.infos, sizeof(VertexStreamAttribute) * format.count);
+		_paletteVertexStreamAttributes.infos[format.count] = VertexStreamAttribute(format.stride, GLProgram::VERTEX_ATTRIB_BLEND_INDEX, GL_UNSIGNED_BYTE, 1, false);
+		_paletteVertexStreamAttributes.count = format.count + 1;
+		_paletteVertexStreamAttributes.stride = format.stride + 4;
+		_paletteVertexStreamAttributes.generateID();
+	}
+
+	generateMaterialId();
+}
+
+bool Material2D::hasSameState(const Material2D* other) const
+{
+	if (this == other) {
+		return true;
+	}
+	// unused texture names are 0, so all of them can be compared
+	return _id == other->_id &&
+		_glProgramState->getGLProgram() == other->_glProgramState->getGLProgram() &&
+		_vertexStreamAttributes.format == other->_vertexStreamAttributes.format &&
+		_blendFunc.src == other->_blendFunc.src &&
+		_blendFunc.dst == other->_blendFunc.dst &&
+		_batchPrimitiveType == other->_batchPrimitiveType &&
+		_skipBatching == other->_skipBatching &&
+		memcmp(_textureNames, other->_textureNames, sizeof(_textureNames)) == 0;
 }
 
 void Material2D::generateMaterialId()
 {
-	if (_glProgramState->getUniformCount() > 0) {
+	// the palette uniform is set by the renderer, so it doesnt prevent batching
+	int uniformCount = (int)_glProgramState->getUniformCount() - (_paletteSize > 0 ? 1 : 0);
+	if (uniformCount > 0) {
 		_id = Renderer::MATERIAL_ID_DO_NOT_BATCH;
 	}
 	else {
-		if (_vertexStreamAttributes.id == 0) { // 0 could be a valid id too but its used as a non-initialize indicator
-			_vertexStreamAttributes.generateID();
-		}
 		int formatId = _vertexStreamAttributes.id;
 		int glProgram = (int)_glProgramState->getGLProgram()->getProgram();
 
 		static const int size = 7 + MAX_TEXTURES_PER_MATERIAL2D;
 
-		int intArray[size] = { glProgram, formatId, (int)_blendFunc.src ,(int)_blendFunc.dst, (int)_primitiveType, (int)_skipBatching };
+		int intArray[size] = { glProgram, formatId, (int)_blendFunc.src ,(int)_blendFunc.dst, (int)_batchPrimitiveType, (int)_skipBatching };
 
 		int j = 0;
 		for (int i = 7; i < size; i++) {
@@ -11,6 +11,10 @@
 NS_CC_BEGIN
 
 class Renderer;
+class RenderDevice;
+class FrameCapture;
+class FrameReplay;
+struct VertexFormat;
 
 enum class MaterialPrimitiveType {
 	TRIANGLE = GL_TRIANGLES,
@@ -22,17 +26,32 @@ enum class MaterialPrimitiveType {
 	LINE_STRIP = GL_LINE_STRIP,
 };
 
+// describes a vertex layout. the infos are owned by the caller, generateID interns the layout in the VertexFormatRegistry
 struct CC_DLL VertexStreamAttributes {
 	VertexStreamAttribute* infos;
 	uint32_t count;
-	uint32_t id;
+	uint32_t id; // the id of the interned format, 0 until generateID is called
 	GLuint stride;
+	const VertexFormat* format; // the interned format
 
 	VertexStreamAttributes();
 	~VertexStreamAttributes();
 
 	void generateID();
 	void apply(void* bufferOffset);
+	void apply(RenderDevice* device, void* bufferOffset);
+
+	// the format used by QuadCommand and TrianglesCommand (V3F_C4B_T2F, 24 bytes)
+	static VertexStreamAttributes* getV3F_C4B_T2F();
+	// packed 2d format the renderer converts V3F_C4B_T2F into for commands using the compact vertex format (V2F_C4B_T2US, 16 bytes)
+	static VertexStreamAttributes* getV2F_C4B_T2US();
+};
+
+// vertex layout of VertexStreamAttributes::getV2F_C4B_T2US(). the tex coords are unsigned normalized
+struct V2F_C4B_T2US {
+	Vec2 vertices;
+	Color4B colors;
+	GLushort texCoords[2];
 };
 
 typedef VertexStreamAttributes VertexAttribInfoFormat;
@@ -51,11 +70,15 @@ public:
 	void init(GLProgramState* program, GLuint* textures, int texturesCount, BlendFunc blendFunc, VertexAttribInfoFormat format, MaterialPrimitiveType primitiveType);
 
 	void apply(const Mat4& modelView);
+	void apply(RenderDevice* device, const Mat4& modelView);
 
 	inline uint32_t getMaterialId() {
 		return _id;
 	}
 
+	// whether the state the id is generated from is equal, the id is only a hash and two different materials can share it
+	bool hasSameState(const Material2D* other) const;
+
 	inline int getVertexAttribInfoFormat() {
 		return _vertexStreamAttributes.id;
 	}
@@ -66,8 +89,25 @@ public:
 
 	inline GLProgramState* getProgramState() const { return _glProgramState; }
 
+	inline const BlendFunc& getBlendFunc() const { return _blendFunc; }
+
+	inline MaterialPrimitiveType getPrimitiveType() const { return _primitiveType; }
+	// strips, fans and loops are converted to lists when gathered, so commands can be concatenated. this is the type the batches are drawn with
+	inline MaterialPrimitiveType getBatchPrimitiveType() const { return _batchPrimitiveType; }
+	static MaterialPrimitiveType getListPrimitiveType(MaterialPrimitiveType type);
+
+	// Lets the renderer draw up to paletteSize gpu transformed commands of this material with different model views in one call.
+	// The program needs a "uniform mat4 u_matrixPalette[paletteSize]" and picks the matrix with the index in a_blendIndex (GLProgram::VERTEX_ATTRIB_BLEND_INDEX),
+	// which the renderer appends to every vertex as one unsigned byte padded to 4 bytes. 0 disables the palette. Call after init
+	void setMatrixPalette(int paletteSize);
+	inline int getMatrixPaletteSize() const { return _paletteSize; }
+	// the largest palette the vertex uniforms of the gl context can hold, at most 256. needs a gl context
+	static int getMaxMatrixPaletteSize();
+
 protected:
 	friend Renderer;
+	friend FrameCapture;
+	friend FrameReplay;
 
 	void generateMaterialId();
 
@@ -78,8 +118,16 @@ protected:
 	BlendFunc _blendFunc;
 	VertexAttribInfoFormat _vertexStreamAttributes;
 	MaterialPrimitiveType _primitiveType;
+	MaterialPrimitiveType _batchPrimitiveType;
 	bool _skipBatching;
 	int _textureCount;
+
+	int _paletteSize;
+	GLint _paletteUniformLocation;
+	VertexAttribInfoFormat _paletteVertexStreamAttributes; // the vertex format plus the matrix index, its infos are owned
+
+private:
+	CC_DISALLOW_COPY_AND_ASSIGN(Material2D);
 };
 
 NS_CC_END
\ No newline at end of file
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <memory>
+#include <string.h>
+
+#include "platform/CCPlatformMacros.h"
+#include "platform/CCGL.h"
+
+NS_CC_BEGIN
+
+class Material2D;
+struct VertexFormat;
+
+// a range inside of the vertex or index buffer. vertex ranges are in bytes, index ranges are in shorts
+struct VertexBatchBufferRange {
+	ssize_t offset; // the offset the vertex attrib pointers or the indices are based on
+	ssize_t usageStart;
+	ssize_t usageEnd;
+};
+
+// the range of base vertex sub draws of an indexed batch, only used when the renderer draws with base vertex
+struct VertexBatchSubDrawRange {
+	int start;
+	int end;
+};
+
+// the range of model view matrices in the renderers palette list a palette batch uses, empty for other batches
+struct VertexBatchPaletteRange {
+	int start;
+	int end;
+};
+
+struct VertexBatchBufferHandles {
+	GLuint vertexBufferHandle;
+	GLuint indexBufferHandle;
+};
+
+enum VertexBatchFlags {
+	VERTEX_BATCH_INDEXED = 1 << 0,
+};
+
+// stores the vertex batches as separate arrays (structure of arrays) so the draw loop and the buffer mapping only touch the fields they need.
+// the storage is chunked: a chunk is never moved once allocated, so references into the list stay valid while it grows.
+// batches are referenced by index
+class VertexBatchList {
+public:
+	static const int CHUNK_SHIFT = 6;
+	static const int CHUNK_SIZE = 1 << CHUNK_SHIFT;
+	static const int CHUNK_MASK = CHUNK_SIZE - 1;
+
+	struct Chunk {
+		int drawPackets[CHUNK_SIZE]; // the batch draw in the renderers packet stream, -1 until the first command is gathered
+		VertexBatchBufferRange vertexRanges[CHUNK_SIZE];
+		VertexBatchBufferRange indexRanges[CHUNK_SIZE];
+		VertexBatchBufferHandles buffers[CHUNK_SIZE];
+		VertexBatchSubDrawRange subDraws[CHUNK_SIZE];
+		VertexBatchPaletteRange palettes[CHUNK_SIZE];
+		Material2D* materials[CHUNK_SIZE];
+		const VertexFormat* formats[CHUNK_SIZE]; // the vertex format the batch was gathered in, may differ from the materials one
+		unsigned char flags[CHUNK_SIZE];
+	};
+
+	VertexBatchList() {
+		_chunkListSize = 4;
+		_chunks = (Chunk**)malloc(sizeof(Chunk*) * _chunkListSize);
+		_chunkCount = 0;
+		_elementCount = 0;
+	}
+	~VertexBatchList() {
+		for (size_t i = 0; i < _chunkCount; i++) {
+			free(_chunks[i]);
+		}
+		free(_chunks);
+	}
+
+	// appends a zero initialized batch and returns its index
+	inline int push_back() {
+		size_t chunkIndex = _elementCount >> CHUNK_SHIFT;
+		if (chunkIndex >= _chunkCount) {
+			if (_chunkCount + 1 > _chunkListSize) {
+				// only the chunk pointer list is moved, the chunks itself stay where they are
+				_chunkListSize *= 2;
+				_chunks = (Chunk**)realloc(_chunks, sizeof(Chunk*) * _chunkListSize);
+			}
+			_chunks[_chunkCount++] = (Chunk*)malloc(sizeof(Chunk));
+		}
+		Chunk* chunk = _chunks[chunkIndex];
+		size_t i = _elementCount & CHUNK_MASK;
+		chunk->drawPackets[i] = -1;
+		memset(&chunk->vertexRanges[i], 0, sizeof(VertexBatchBufferRange));
+		memset(&chunk->indexRanges[i], 0, sizeof(VertexBatchBufferRange));
+		memset(&chunk->buffers[i], 0, sizeof(VertexBatchBufferHandles));
+		memset(&chunk->subDraws[i], 0, sizeof(VertexBatchSubDrawRange));
+		memset(&chunk->palettes[i], 0, sizeof(VertexBatchPaletteRange));
+		chunk->materials[i] = nullptr;
+		chunk->formats[i] = nullptr;
+		chunk->flags[i] = 0;
+		return (int)_elementCount++;
+	}
+
+	inline int& drawPacket(int index) { return _chunks[index >> CHUNK_SHIFT]->drawPackets[index & CHUNK_MASK]; }
+	inline VertexBatchBufferRange& vertexRange(int index) { return _chunks[index >> CHUNK_SHIFT]->vertexRanges[index & CHUNK_MASK]; }
+	inline VertexBatchBufferRange& indexRange(int index) { return _chunks[index >> CHUNK_SHIFT]->indexRanges[index & CHUNK_MASK]; }
+	inline VertexBatchBufferHandles& buffers(int index) { return _chunks[index >> CHUNK_SHIFT]->buffers[index & CHUNK_MASK]; }
+	inline VertexBatchSubDrawRange& subDraws(int index) { return _chunks[index >> CHUNK_SHIFT]->subDraws[index & CHUNK_MASK]; }
+	inline VertexBatchPaletteRange& palette(int index) { return _chunks[index >> CHUNK_SHIFT]->palettes[index & CHUNK_MASK]; }
+	inline Material2D*& material(int index) { return _chunks[index >> CHUNK_SHIFT]->materials[index & CHUNK_MASK]; }
+	inline const VertexFormat*& format(int index) { return _chunks[index >> CHUNK_SHIFT]->formats[index & CHUNK_MASK]; }
+	inline unsigned char& flags(int index) { return _chunks[index >> CHUNK_SHIFT]->flags[index & CHUNK_MASK]; }
+
+	// chunk access for streaming passes over all batches
+	inline size_t getChunkCount() const { return (_elementCount + CHUNK_MASK) >> CHUNK_SHIFT; }
+	inline Chunk* chunkAt(size_t chunkIndex) { return _chunks[chunkIndex]; }
+	// the number of used batches in the given chunk
+	inline size_t getCountInChunk(size_t chunkIndex) const {
+		size_t remaining = _elementCount - (chunkIndex << CHUNK_SHIFT);
+		return remaining > (size_t)CHUNK_SIZE ? CHUNK_SIZE : remaining;
+	}
+
+	inline size_t size() const { return _elementCount; }
+
+	// keeps the chunks allocated for the next frame
+	void clear() {
+		_elementCount = 0;
+	}
+
+protected:
+	Chunk** _chunks;
+	size_t _chunkCount;
+	size_t _chunkListSize;
+	size_t _elementCount;
+};
+
+NS_CC_END